@@ -0,0 +1,33 @@
+#ifndef _ADMIN_H_
+#define _ADMIN_H_
+
+#include <errno.h>
+
+#include "server.h"
+
+#define ERROR_ADMIN_NULL 1
+#define ERROR_ADMIN_ALLOCATION 1
+#define ERROR_ADMIN_SOCKET 1
+#define ERROR_ADMIN_THREAD 1
+
+typedef struct _admin admin_t;
+
+// Control socket of running server. Commands are lines, each is answered by
+// a line, that starts with "ok" or "error":
+//   threads [count]    size of worker pool
+//   timeout [ms]       connection timeout, effective one is reported
+//   level error|warning|info|debug|all
+//   reload             workers are restarted
+//   stats              counters of server, pool, timeout and headroom
+//
+// Unix socket is bound at once, so that it may be placed outside of root,
+// that process is confined to later. Only owner may connect. Socket of
+// previous instance on the path is replaced and the own one is left on exit.
+admin_t *admin_init(const char *const path);
+// Clients are served one by one on a thread of its own until admin_free, so
+// it has to be started after server_setup
+int admin_start(admin_t *const admin, server_t *const server);
+void admin_free(admin_t **const admin);
+
+#endif
+
@@ -16,12 +16,17 @@
 typedef int (*handler_func_t)(const int fd, const request_t *const request,
                               void *arg);
 
+// Immediate handler only sends a short answer with a single non-blocking
+// send and never blocks otherwise, so event loop may call it by itself on a
+// request, that is already received, instead of handing it to worker. Its
+// check has to tell request by title only.
 typedef struct
 {
     int (*check)(const request_t *const request);
     handler_func_t function;
     void *arg;
     void (*free_callback)(void **const arg);
+    int immediate;
 } handler_t;
 
 typedef struct _handler_call handler_call_t;
@@ -36,6 +41,13 @@ handler_list_t *handler_list_init(void);
 int handler_list_push(handler_list_t *list, const handler_t *const handler);
 int handler_list_find(handler_list_t *list, const request_t *const request,
                       handler_call_t *const call);
+// Only immediate handlers, that precede every other one, are looked up, so
+// that the rest of checks isn't run on event loop
+int handler_list_find_immediate(handler_list_t *list,
+                                const request_t *const request,
+                                handler_call_t *const call);
+// Count of immediate handlers, that precede every other one
+size_t handler_list_immediate(const handler_list_t *const list);
 void handler_list_free(handler_list_t **list);
 
 #endif
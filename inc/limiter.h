@@ -0,0 +1,46 @@
+#ifndef _LIMITER_H_
+#define _LIMITER_H_
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define ERROR_LIMITER_NULL        1
+#define ERROR_LIMITER_ALLOCATION  1
+#define ERROR_LIMITER_INVALID     1
+#define ERROR_LIMITER_CONNECTIONS 1
+#define ERROR_LIMITER_RATE        1
+
+// Limits of a single client address, 0 turns the limit off. Requests are
+// counted by token bucket, that holds burst tokens and refills at rate.
+typedef struct
+{
+    size_t connections;     // open at once
+    size_t rate;            // requests per second
+    size_t burst;           // 0 for rate
+} limiter_limits_t;
+
+typedef struct _limiter limiter_t;
+
+// Clients are kept in hash table split into shards, each under lock of its
+// own, so that loops and workers contend only on the same shard. IPv6
+// clients are told apart by /64 prefix, as one host usually gets a whole of
+// it. Table is sized by descriptor limit once: connections with a greater
+// descriptor aren't limited.
+limiter_t *limiter_init(const limiter_limits_t *const limits);
+// Connection on descriptor is counted for its peer, until it is released.
+// ERROR_LIMITER_CONNECTIONS is returned, when peer has no connections left,
+// connection isn't counted then. Peers other than IPv4 and IPv6 and those,
+// that don't fit into full table, aren't limited.
+int limiter_acquire(limiter_t *const limiter, const int fd,
+                    const struct sockaddr *const address, const socklen_t len);
+// Request on connection takes a token of its peer. ERROR_LIMITER_RATE is
+// returned, when there is none.
+int limiter_take(limiter_t *const limiter, const int fd);
+// Has to be called before descriptor is closed, as it may be taken by the
+// next connection right after
+void limiter_release(limiter_t *const limiter, const int fd);
+void limiter_free(limiter_t **const limiter);
+
+#endif
+
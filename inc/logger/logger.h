@@ -23,6 +23,7 @@ typedef struct
 
 #define LOG_INIT(logger) _logger_set((logger))
 #define LOG_CLOSE() _logger_close()
+#define LOG_LIMIT(limit) _logger_limit((limit))
 #define LOG_F(priority, format, ...) _logger_log((priority), "[%s] " format, __func__, __VA_ARGS__)
 #define LOG_M(priority, msg) _logger_log((priority), "[%s] " msg, __func__)
 
@@ -30,6 +31,8 @@ void logger_log(logger_t logger, log_level_t level, const char *const format, ..
 
 void _logger_set(logger_t logger);
 void _logger_close(void);
+// Limit may be changed, while other threads log
+void _logger_limit(log_level_t limit);
 void _logger_log(log_level_t level, const char *const format, ...);
 
 #endif
@@ -4,8 +4,6 @@
 #include <stdlib.h>
 #include <errno.h>
 
-#include "list.h"
-
 #define ERROR_MULTIPLEXER_NULL            1
 #define ERROR_MULTIPLEXER_INVALID         1
 #define ERROR_MULTIPLEXER_ALLOCATION      1
@@ -14,26 +12,52 @@
 #define ERROR_MULTIPLEXER_LIST_OPERATION  1
 #define ERROR_MULTIPLEXER_SELECT_ERROR    1
 #define ERROR_MULTIPLEXER_OVERFLOW        1
+#define ERROR_MULTIPLEXER_POLL_INIT       1
+#define ERROR_MULTIPLEXER_POLL_OPERATION  1
 
 enum
 {
-    READ  = 1,
-    WRITE = 2
+    READ    = 1,
+    WRITE   = 2,
+    HANGUP  = 4,
+    TIMEOUT = 8
 };
 
+typedef struct
+{
+    int fd;
+    int events;
+} multiplexer_event_t;
+
+typedef enum
+{
+    MULTIPLEXER_EPOLL,
+    MULTIPLEXER_POLL,
+    MULTIPLEXER_SELECT
+} multiplexer_type_t;
+
 typedef struct _multiplexer multiplexer_t;
 
-multiplexer_t *multiplexer_init(void);
+multiplexer_t *multiplexer_init(const multiplexer_type_t type);
 
-int multiplexer_wait(multiplexer_t *const multiplexer, list_t *ready,
-                     const size_t timeout);
+int multiplexer_wait(multiplexer_t *const multiplexer,
+                     multiplexer_event_t *const events, const size_t capacity,
+                     size_t *const count, const size_t timeout);
 
 int multiplexer_add(multiplexer_t *const multiplexer, const int socket,
                     const int status, const size_t timeout);
-int multiplexer_timeout(multiplexer_t *const multiplexer, list_t *deleted);
+int multiplexer_timeout(multiplexer_t *const multiplexer,
+                        multiplexer_event_t *const events,
+                        const size_t capacity, size_t *const count);
 int multiplexer_remove(multiplexer_t *const multiplexer, const int socket);
 int multiplexer_clear(multiplexer_t *const multiplexer);
 
+// Number of registered sockets
+size_t multiplexer_size(multiplexer_t *const multiplexer);
+// Sockets, which timeout would run out later, than in timeout milliseconds
+// from now, get this timeout instead
+int multiplexer_shorten(multiplexer_t *const multiplexer, const size_t timeout);
+
 void multiplexer_free(multiplexer_t **multiplexer);
 
 #endif
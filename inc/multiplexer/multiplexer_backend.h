@@ -0,0 +1,50 @@
+#ifndef _MULTIPLEXER_BACKEND_H_
+#define _MULTIPLEXER_BACKEND_H_
+
+#include <stdlib.h>
+
+#include "multiplexer.h"
+#include "timer_wheel.h"
+
+// Registry slot of a socket. Index is owned by backend and may be used to
+// locate socket in its own structures.
+typedef struct
+{
+    timer_wheel_entry_t timer;
+    int fd;
+    int status;
+    unsigned generation;
+    size_t index;
+} multiplexer_slot_t;
+
+// Raw readiness reported by backend. Generation is the one slot had, when
+// socket was handed to the kernel.
+typedef struct
+{
+    int fd;
+    unsigned generation;
+    int events;
+} multiplexer_ready_t;
+
+// Add and remove are called under multiplexer mutex, wait is called without
+// it. Backends, that can't share their set with a waiting thread, provide
+// prepare, which is called under the mutex right before wait and should copy
+// the set for it. Such backends are woken up through a registered eventfd,
+// when the set changes during wait.
+typedef struct
+{
+    int (*init)(void **const data);
+    int (*add)(void *const data, multiplexer_slot_t *const slot);
+    int (*remove)(void *const data, multiplexer_slot_t *const slot);
+    int (*prepare)(void *const data);
+    int (*wait)(void *const data, multiplexer_ready_t *const ready,
+                const size_t capacity, size_t *const count, const int timeout);
+    void (*free)(void **const data);
+} multiplexer_backend_t;
+
+multiplexer_backend_t epoll_backend_get(void);
+multiplexer_backend_t poll_backend_get(void);
+multiplexer_backend_t select_backend_get(void);
+
+#endif
+
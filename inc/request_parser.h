@@ -15,6 +15,9 @@
 #define ERROR_REQUEST_PARSER_EMPTY_READ      1
 #define ERROR_REQUEST_PARSER_CLEAR           1
 #define ERROR_REQUEST_PARSER_INCORRECT       1
+#define ERROR_REQUEST_PARSER_TIMEOUT         1
+#define ERROR_REQUEST_PARSER_WRITE_ERROR     1
+#define ERROR_REQUEST_PARSER_TOO_LARGE       1
 
 typedef struct _request request_t;
 
@@ -25,9 +28,60 @@ typedef struct
     const char *version;
 } request_title_t;
 
+// Limits of slow clients, 0 turns either off. Request has to be received
+// within timeout (ms) since it is started to be read. Response may fall
+// behind rate (bytes per second) by no more than grace (ms). Request line
+// has to fit into line bytes, the whole header into header ones and body
+// into body ones.
+typedef struct
+{
+    size_t timeout;
+    size_t rate;
+    size_t grace;
+    size_t line;
+    size_t header;
+    size_t body;
+} request_limits_t;
+
+// Buffer grows for request, that doesn't fit, and shrinks back to size, once
+// the next one is started to be read
 request_t *request_blank(const size_t size);
+int request_set_limits(request_t *request,
+                       const request_limits_t *const limits);
 request_t *request_read(const int socket);
+// Next request is taken from bytes left after the previous one, receiving
+// from socket until it is complete
 int request_read_exist(request_t *request, const int socket);
+int request_read_buffer(request_t *request, const char *const data,
+                        const size_t size);
+// Only request line of data is parsed, so title is the only part to be used
+int request_read_title(request_t *request, const char *const data,
+                       const size_t size);
+// Data is treated as received before anything else is read from socket
+int request_append(request_t *request, const char *const data,
+                   const size_t size);
+// Drops everything received, before request is used for another connection
+void request_reset(request_t *request);
+// Bytes received after the current request
+size_t request_pending(const request_t *const request);
+// Set, when read failed because peer closed connection between requests
+int request_closed(const request_t *const request);
+// Set, when read failed because request wasn't received within timeout
+int request_expired(const request_t *const request);
+// Set, when read failed because request line or header is over limits. Only
+// so much of request is received, as it takes to tell it.
+int request_too_long(const request_t *const request);
+int request_too_large(const request_t *const request);
+// Set, when Content-Length is over limits. Body isn't received then.
+int request_body_too_large(const request_t *const request);
+// Set, when read failed because Content-Length isn't a valid length
+int request_malformed(const request_t *const request);
+// Data is sent whole on blocking socket. Peer, that doesn't take it at rate
+// of limits, is given up on and marked slow.
+int request_send(const request_t *const request, const int socket,
+                 const void *const data, const size_t size);
+int request_slow(const request_t *const request);
+int request_keep_alive(const request_t *const request);
 const request_title_t *request_title(const request_t *const request);
 const char *request_at(const request_t *const request, const char *const header);
 const char *request_pararmeters_at(const request_t *const request, const char *const parameter);
@@ -4,8 +4,12 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <sys/socket.h>
 
 #include "handler.h"
+#include "multiplexer.h"
+#include "worker.h"
+#include "limiter.h"
 
 #define ERROR_SERVER_NULL 1
 #define ERROR_SERVER_NOT_SETUP 1
@@ -18,19 +22,157 @@
 #define ERROR_SERVER_ACCEPT 1
 #define ERROR_SERVER_WRITE 1
 #define ERROR_SERVER_CLOSE 1
+#define ERROR_SERVER_URING 1
+#define ERROR_SERVER_MODE 1
+#define ERROR_SERVER_SIGNAL 1
+#define ERROR_SERVER_INVALID 1
 
 typedef struct _server server_t;
 
+typedef enum
+{
+    SERVER_ENGINE_REACTOR,  // readiness multiplexer, workers read requests
+    SERVER_ENGINE_URING     // io_uring completions, requests read in loop
+} server_engine_t;
+
+typedef enum
+{
+    SERVER_MODE_DISPATCH,   // one event loop hands connections to workers
+    SERVER_MODE_SHARDED,    // every thread listens, waits and serves alone
+    SERVER_MODE_LEADER      // threads take turns waiting and serve themselves
+} server_mode_t;
+
+// Connection timeout shrinks linearly from the one set by server_set_timeout
+// down to minimum (ms), while occupied share of capacity grows from low to
+// high percent. Capacity of 0 stands for descriptor limit of process.
+typedef struct
+{
+    size_t capacity;
+    unsigned low;
+    unsigned high;
+    size_t minimum;
+} server_timeout_curve_t;
+
+// Address to listen on: IPv4 or IPv6 one with port or path of unix socket.
+// IPv6 endpoint takes IPv4 connections as well, unless v6only is set.
+typedef struct
+{
+    int family;             // AF_INET, AF_INET6 or AF_UNIX
+    const char *address;    // numeric, NULL for any; path for AF_UNIX
+    int port;
+    int v6only;
+} server_endpoint_t;
+
+// Options of listening sockets, 0 leaves the one of system. TCP ones are
+// skipped on unix sockets.
+typedef struct
+{
+    int backlog;            // 0 for SOMAXCONN, the kernel caps it as well
+    int defer_accept;       // s, connection is accepted once data arrives
+    int fastopen;           // queue of TCP Fast Open requests
+    int incoming_cpu;       // listeners of shard prefer its CPU, if sharded
+    int busy_poll;          // us, raising it may require CAP_NET_ADMIN
+} server_tuning_t;
+
+// Totals since server_init. Connections are either dispatched to workers or
+// served by event loop itself, refused ones are answered with 503 and limited
+// ones with 429. Slow clients are cut off, with 408, if request is late.
+typedef struct
+{
+    size_t accepted;
+    size_t dispatched;
+    size_t served;
+    size_t refused;
+    size_t limited;
+    size_t slow;
+} server_counters_t;
+
+// Blocks SIGINT, SIGTERM, SIGHUP, SIGQUIT and SIGCHLD, so it has to be called
+// before any thread is started. Signals are received by running servers
+// through signalfd: the first two stop them, SIGHUP reloads, SIGQUIT drains.
+// Soft descriptor limit is raised to the hard one and a spare descriptor is
+// kept to refuse connections, when the limit is hit.
 int server_setup(void);
 void server_destroy(void);
 
-void server_termination_handler(int signum);
-
 server_t *server_init(int port, size_t max_threads);
+// Up to 16 endpoints are listened on and served by the same loops and workers.
+// Without any every IPv4 address is listened on port of server_init. Path of
+// unix socket is resolved after root is changed, stale socket on it is
+// replaced and the one of server is left on exit.
+int server_add_endpoint(server_t *const server,
+                        const server_endpoint_t *const endpoint);
+// Endpoints of guest, or its port without any, are listened on by server and
+// their requests are answered by handlers of guest, while workers, loops and
+// settings of server are shared. Guest can't be run by itself after that and
+// has to outlive mainloop of server.
+int server_attach(server_t *const server, server_t *const guest);
 int server_set_timeout(server_t *const server, size_t timeout);
+int server_set_timeout_curve(server_t *const server,
+                             const server_timeout_curve_t *const curve);
+// Timeout, that is currently given to new connections
+size_t server_get_timeout(const server_t *const server);
+// Worker pool may be resized, while mainloop runs in dispatch mode: event loop
+// restarts workers like on reload, each after its queued tasks. Other modes
+// and prefork master refuse it, as their thread count is fixed on start.
+int server_set_threads(server_t *const server, const size_t threads);
+size_t server_get_threads(const server_t *const server);
+int server_get_counters(const server_t *const server,
+                        server_counters_t *const counters);
+// Descriptors, that the process can still open
+size_t server_get_headroom(void);
+// Connections accepted at most on one readiness of listener. Multishot accept
+// of uring engine is not limited by it.
+int server_set_accept_budget(server_t *const server, const size_t budget);
+// Admission of workers by queue delay, target of 50 ms over 500 ms interval by
+// default. Deadline of 0 stands for connection timeout.
+int server_set_admission(server_t *const server,
+                         const worker_admission_t *const admission);
+// Prefork: listener is bound once and served by this many child processes,
+// each running the configured mode and respawned, when it exits. 0 keeps a
+// single process.
+int server_set_processes(server_t *const server, const size_t processes);
+// Upgrade: on start listeners are taken over from instance, that runs on the
+// same port with the same endpoints, which then stops and drains its
+// connections. Running instance hands its listeners in turn to the next one.
+// Shards bind their own.
+int server_set_upgrade(server_t *const server, const int upgrade);
+// Limits of client address: connection over its cap is answered with 429 and
+// closed on accept, the same happens to request, that finds its bucket empty,
+// before it is read or dispatched. Every loop and worker of server share the
+// same clients, while each prefork child counts its own.
+int server_set_limits(server_t *const server,
+                      const limiter_limits_t *const limits);
+// Deadlines of slow clients: request has to be received within timeout, 10 s
+// by default, and response is sent at least at rate after grace, unless it
+// is 0 as by default. Either is checked by any thread, that reads or sends,
+// so slow client holds a worker no longer than that. Sizes of limits are
+// left as they are.
+int server_set_deadlines(server_t *const server,
+                         const request_limits_t *const deadlines);
+// Request line over line bytes is refused with 414, header over header
+// bytes with 431 and body over body bytes with 413, 8 KiB, 64 KiB and 1 MiB
+// by default. 0 turns either off. Buffers, that grow for such outliers,
+// shrink back after them.
+int server_set_request_size(server_t *const server, const size_t line,
+                            const size_t header, const size_t body);
+// Every option is set, then read back and reported on startup. Options, that
+// are refused, are only warned about.
+int server_set_tuning(server_t *const server,
+                      const server_tuning_t *const tuning);
+// Affinity: workers and shards are pinned each to its CPU of those, that the
+// process may run on. Connection is dispatched to worker on CPU, that has
+// received it, and shards prefer connections received by their own CPU.
+int server_set_affinity(server_t *const server, const int affinity);
+int server_set_engine(server_t *const server, const server_engine_t engine);
+int server_set_multiplexer(server_t *const server,
+                           const multiplexer_type_t type);
+int server_set_mode(server_t *const server, const server_mode_t mode);
 int server_register_handler(server_t *const server,
                             const handler_t *const handler);
 int server_mainloop(server_t *const server);
+int server_stop(server_t *const server);
+int server_reload(server_t *const server);
 
 void server_free(server_t **const server);
 
@@ -0,0 +1,51 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdlib.h>
+#include <errno.h>
+
+#define ERROR_TIMER_WHEEL_NULL       1
+#define ERROR_TIMER_WHEEL_ALLOCATION 1
+#define ERROR_TIMER_WHEEL_ARMED      1
+
+// Returned by timer_wheel_next, when no entry is armed
+#define TIMER_WHEEL_NONE ((size_t)-1)
+
+// Entry is embedded into owner structure, so arm and cancel never allocate.
+// Owner must keep it at the same address while armed.
+typedef struct _timer_wheel_entry timer_wheel_entry_t;
+
+struct _timer_wheel_entry
+{
+    timer_wheel_entry_t *next;
+    timer_wheel_entry_t *prev;
+    size_t expire;
+    size_t slot;
+    int armed;
+};
+
+// Expiration stops, when func returns anything but EXIT_SUCCESS. Entry, it
+// was called with, stays armed and is reported again on the next call.
+typedef struct
+{
+    int (*func)(void *arg, timer_wheel_entry_t *entry);
+    void *arg;
+} timer_wheel_handler_t;
+
+typedef struct _timer_wheel timer_wheel_t;
+
+size_t timer_wheel_clock(void);
+
+timer_wheel_t *timer_wheel_init(void);
+void timer_wheel_entry_init(timer_wheel_entry_t *const entry);
+int timer_wheel_arm(timer_wheel_t *const wheel,
+                    timer_wheel_entry_t *const entry, const size_t timeout);
+int timer_wheel_cancel(timer_wheel_t *const wheel,
+                       timer_wheel_entry_t *const entry);
+int timer_wheel_expire(timer_wheel_t *const wheel,
+                       const timer_wheel_handler_t *const handler);
+size_t timer_wheel_next(const timer_wheel_t *const wheel);
+void timer_wheel_free(timer_wheel_t **const wheel);
+
+#endif
+
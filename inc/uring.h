@@ -0,0 +1,41 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <linux/io_uring.h>
+
+#define ERROR_URING_NULL        1
+#define ERROR_URING_INVALID     1
+#define ERROR_URING_ALLOCATION  1
+#define ERROR_URING_SETUP       1
+#define ERROR_URING_UNSUPPORTED 1
+#define ERROR_URING_MAP         1
+#define ERROR_URING_REGISTER    1
+#define ERROR_URING_ENTER       1
+#define ERROR_URING_FULL        1
+
+// Group id of provided buffers registered with uring_buffers_init
+#define URING_BUFFER_GROUP 0
+
+typedef struct _uring uring_t;
+
+uring_t *uring_init(const unsigned entries);
+
+struct io_uring_sqe *uring_sqe(uring_t *const ring);
+int uring_submit(uring_t *const ring, const unsigned wait,
+                 const size_t timeout);
+
+struct io_uring_cqe *uring_cqe(uring_t *const ring);
+void uring_cqe_seen(uring_t *const ring);
+
+int uring_buffers_init(uring_t *const ring, const unsigned count,
+                       const size_t size);
+const char *uring_buffer(const uring_t *const ring, const unsigned id);
+void uring_buffer_recycle(uring_t *const ring, const unsigned id);
+
+void uring_free(uring_t **const ring);
+
+#endif
+
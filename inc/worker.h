@@ -4,6 +4,7 @@
 #include <stdlib.h>
 
 #include "handler.h"
+#include "limiter.h"
 
 #define ERROR_WORKER_NULL 1
 #define ERROR_WORKER_SOCKET_INIT 1
@@ -23,13 +24,23 @@
 #define WORKER_ERROR_LOCK           6
 #define WORKER_ERROR_CALLBACK       7
 #define WORKER_ERROR_ALLOCAION      8
+#define WORKER_ERROR_OVERLOAD       9
+#define WORKER_ERROR_TIMEOUT        10
+#define WORKER_ERROR_SLOW           11
+#define WORKER_ERROR_LONG_LINE      12
+#define WORKER_ERROR_LARGE_HEADER   13
+#define WORKER_ERROR_BAD_REQUEST    14
+#define WORKER_ERROR_LARGE_BODY     15
+#define WORKER_ERROR_LIMITED        16
 
 typedef struct _worker worker_t;
 
+// Called, when task is done. Socket is either closed or kept for the next
+// request, when keep is set.
 typedef struct
 {
     void *arg;
-    int (*func)(void *arg, int socket);
+    int (*func)(void *arg, int socket, int keep);
 } worker_callback_t;
 
 typedef struct
@@ -38,17 +49,73 @@ typedef struct
     void (*func)(void *arg, int socket, int error);
 } worker_error_t;
 
+// Connection handed to a worker. Data, if present, holds bytes of request
+// already received from socket and is released by worker. Stamp is set on
+// enqueue. Handlers, if set, answer requests instead of those of worker.
+// Limiter, if set, is taken a token from by every pipelined request after
+// the first one, which is counted on dispatch.
+typedef struct
+{
+    int fd;
+    char *data;
+    size_t size;
+    size_t stamp;
+    handler_list_t *handlers;
+    limiter_t *limiter;
+} worker_task_t;
+
+// Admission by queue delay (ms). Once tasks have waited longer than target
+// for a whole interval, worker sheds late ones with WORKER_ERROR_OVERLOAD and
+// dispatch refuses new ones, until delay falls below target again. Tasks,
+// that have waited for deadline, are always shed. Zero disables either.
+typedef struct
+{
+    size_t target;
+    size_t interval;
+    size_t deadline;
+} worker_admission_t;
+
 size_t worker_size(void);
 
+// Thread of worker is pinned to cpu, -1 leaves it to scheduler. Requests,
+// that aren't received within limits, fail with WORKER_ERROR_TIMEOUT, and
+// responses, that aren't taken fast enough, with WORKER_ERROR_SLOW. Request
+// line, header or body over limits fail with WORKER_ERROR_LONG_LINE,
+// WORKER_ERROR_LARGE_HEADER and WORKER_ERROR_LARGE_BODY, and ones, that
+// can't be framed, with WORKER_ERROR_BAD_REQUEST.
 int worker_init(worker_t *worker, handler_list_t *handlers,
-                worker_callback_t *callback, worker_error_t *error);
+                worker_callback_t *callback, worker_error_t *error,
+                const worker_admission_t *const admission,
+                const request_limits_t *const limits, const int cpu);
 int worker_is_alive(worker_t *worker);
 int worker_is_active(worker_t *worker);
 int worker_error(worker_t *worker);
 int worker_request(worker_t *worker, const int fd);
+int worker_request_task(worker_t *worker, const worker_task_t *const task);
 int worker_request_dispatch(worker_t *worker, const size_t size, const int fd);
+int worker_request_dispatch_task(worker_t *worker, const size_t size,
+                                 const worker_task_t *const task);
+// Task goes to the least loaded of workers pinned to cpu, unless its queue is
+// longer than the shortest one by more than a few tasks. Otherwise it is
+// dispatched as usual.
+int worker_request_dispatch_cpu(worker_t *worker, const size_t size,
+                                const worker_task_t *const task,
+                                const int cpu);
 int worker_wake_up(worker_t *worker, const size_t size);
+
+// Reads requests of the task and answers them in order on the calling
+// thread, while they are already received. Keep is set, when connection
+// stays open for the next request. On failure error is set to one of
+// WORKER_ERROR_*, WORKER_ERROR_LIMITED, when client runs out of tokens.
+int worker_serve(handler_list_t *handlers, request_t *request,
+                 handler_call_t *call, const worker_task_t *const task,
+                 int *const keep, int *const error);
 void *worker_main(void *arg);
+// Worker is told to exit after tasks, that are already queued, without
+// waiting for it. Once it has finished, owner is told with socket -1, as on
+// unexpected exit, and worker_destroy doesn't block.
+int worker_stop(worker_t *worker);
+int worker_is_finished(worker_t *worker);
 void worker_destroy(worker_t *worker);
 
 #endif
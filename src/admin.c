@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include "admin.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "logger.h"
+
+#define ADMIN_LINE 256
+
+struct _admin
+{
+    int listen;
+    int stop;
+    int started;
+    pthread_t thread;
+    server_t *server;
+};
+
+typedef int (*admin_command_t)(admin_t *const admin, const char *const value,
+                               char *const reply, const size_t size);
+
+static int admin_number(const char *const value, size_t *const number)
+{
+    char *end = NULL;
+
+    if (NULL == value || '-' == *value)
+        return EXIT_FAILURE;
+
+    *number = strtoull(value, &end, 10);
+
+    return end == value || 0 != *end ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int admin_threads(admin_t *const admin, const char *const value,
+                         char *const reply, const size_t size)
+{
+    size_t threads = 0;
+
+    if (NULL == value)
+        return snprintf(reply, size, "ok %zu",
+                        server_get_threads(admin->server));
+
+    if (EXIT_SUCCESS != admin_number(value, &threads) || 0 == threads)
+        return snprintf(reply, size, "error invalid count");
+
+    if (EXIT_SUCCESS != server_set_threads(admin->server, threads))
+        return snprintf(reply, size, "error pool can't be resized");
+
+    LOG_F(WARNING, "Admin: worker pool of %zu requested", threads);
+
+    return snprintf(reply, size, "ok");
+}
+
+static int admin_timeout(admin_t *const admin, const char *const value,
+                         char *const reply, const size_t size)
+{
+    size_t timeout = 0;
+
+    if (NULL == value)
+        return snprintf(reply, size, "ok %zu",
+                        server_get_timeout(admin->server));
+
+    if (EXIT_SUCCESS != admin_number(value, &timeout))
+        return snprintf(reply, size, "error invalid timeout");
+
+    if (EXIT_SUCCESS != server_set_timeout(admin->server, timeout))
+        return snprintf(reply, size, "error timeout can't be set");
+
+    LOG_F(WARNING, "Admin: connection timeout set to %zu ms", timeout);
+
+    return snprintf(reply, size, "ok");
+}
+
+static int admin_level(admin_t *const admin, const char *const value,
+                       char *const reply, const size_t size)
+{
+    static const char *const names[] = {"error", "warning", "info", "debug",
+                                        "all"};
+    static const log_level_t levels[] = {ERROR, WARNING, INFO, DEBUG, ALL};
+    size_t i = 0;
+
+    (void)admin;
+
+    for (; NULL != value && sizeof(names) / sizeof(names[0]) > i
+           && strcmp(names[i], value); i++);
+
+    if (NULL == value || sizeof(names) / sizeof(names[0]) == i)
+        return snprintf(reply, size, "error unknown level");
+
+    LOG_F(WARNING, "Admin: log level set to %s", value);
+    LOG_LIMIT(levels[i]);
+
+    return snprintf(reply, size, "ok");
+}
+
+static int admin_reload(admin_t *const admin, const char *const value,
+                        char *const reply, const size_t size)
+{
+    if (NULL != value)
+        return snprintf(reply, size, "error unexpected argument");
+
+    if (EXIT_SUCCESS != server_reload(admin->server))
+        return snprintf(reply, size, "error reload failed");
+
+    LOG_M(WARNING, "Admin: reload requested");
+
+    return snprintf(reply, size, "ok");
+}
+
+static int admin_stats(admin_t *const admin, const char *const value,
+                       char *const reply, const size_t size)
+{
+    server_counters_t counters;
+
+    if (NULL != value)
+        return snprintf(reply, size, "error unexpected argument");
+
+    if (EXIT_SUCCESS != server_get_counters(admin->server, &counters))
+        return snprintf(reply, size, "error counters are unavailable");
+
+    return snprintf(reply, size, "ok accepted=%zu dispatched=%zu served=%zu "
+                    "refused=%zu limited=%zu slow=%zu threads=%zu "
+                    "timeout=%zu headroom=%zu", counters.accepted,
+                    counters.dispatched, counters.served, counters.refused,
+                    counters.limited, counters.slow,
+                    server_get_threads(admin->server),
+                    server_get_timeout(admin->server), server_get_headroom());
+}
+
+static const struct
+{
+    const char *name;
+    admin_command_t command;
+} commands[] =
+{
+    {"threads", admin_threads},
+    {"timeout", admin_timeout},
+    {"level", admin_level},
+    {"reload", admin_reload},
+    {"stats", admin_stats}
+};
+
+static const size_t csize = sizeof(commands) / sizeof(commands[0]);
+
+// Command takes at most one argument. Empty line is skipped.
+static int admin_command(admin_t *const admin, const int peer,
+                         char *const line)
+{
+    char reply[ADMIN_LINE], *save = NULL;
+    char *name = strtok_r(line, " \t\r", &save);
+    char *value = strtok_r(NULL, " \t\r", &save);
+    int len = 0;
+    size_t i = 0;
+
+    if (NULL == name)
+        return EXIT_SUCCESS;
+
+    for (; csize > i && strcmp(commands[i].name, name); i++);
+
+    if (NULL != strtok_r(NULL, " \t\r", &save))
+        len = snprintf(reply, sizeof(reply), "error too many arguments");
+    else if (csize == i)
+        len = snprintf(reply, sizeof(reply), "error unknown command");
+    else
+        len = commands[i].command(admin, value, reply, sizeof(reply));
+
+    if (0 > len || sizeof(reply) - 1 <= (size_t)len)
+        len = snprintf(reply, sizeof(reply), "error reply is too long");
+
+    reply[len++] = '\n';
+
+    return len == send(peer, reply, len, MSG_NOSIGNAL) ? EXIT_SUCCESS
+                                                       : ERROR_ADMIN_SOCKET;
+}
+
+// Every complete line is answered, the rest waits for the next receive. Line,
+// that doesn't fit into buffer, ends session.
+static int admin_lines(admin_t *const admin, const int peer,
+                       char *const buffer, size_t *const size)
+{
+    int rc = EXIT_SUCCESS;
+    char *start = buffer, *end = NULL;
+
+    while (EXIT_SUCCESS == rc
+           && NULL != (end = memchr(start, '\n', buffer + *size - start)))
+    {
+        *end = 0;
+        rc = admin_command(admin, peer, start);
+        start = end + 1;
+    }
+
+    *size -= start - buffer;
+    memmove(buffer, start, *size);
+
+    if (ADMIN_LINE == *size)
+        rc = ERROR_ADMIN_SOCKET;
+
+    return rc;
+}
+
+// Client is served, until it disconnects or admin is stopped
+static void admin_session(admin_t *const admin, const int peer)
+{
+    struct pollfd fds[2] = {{peer, POLLIN, 0}, {admin->stop, POLLIN, 0}};
+    char buffer[ADMIN_LINE];
+    size_t size = 0;
+    int rc = EXIT_SUCCESS;
+
+    while (EXIT_SUCCESS == rc)
+    {
+        if (-1 == poll(fds, 2, -1) || POLLIN & fds[1].revents)
+            rc = ERROR_ADMIN_SOCKET;
+        else if (fds[0].revents)
+        {
+            ssize_t got = recv(peer, buffer + size, sizeof(buffer) - size, 0);
+
+            if (0 >= got)
+                rc = ERROR_ADMIN_SOCKET;
+            else
+            {
+                size += got;
+                rc = admin_lines(admin, peer, buffer, &size);
+            }
+        }
+    }
+}
+
+static void *admin_main(void *arg)
+{
+    admin_t *admin = arg;
+    struct pollfd fds[2] = {{admin->listen, POLLIN, 0},
+                            {admin->stop, POLLIN, 0}};
+
+    // Signals are blocked by server_setup, so poll isn't interrupted
+    while (-1 != poll(fds, 2, -1) && !(POLLIN & fds[1].revents))
+    {
+        int peer = accept4(admin->listen, NULL, NULL, SOCK_CLOEXEC);
+
+        if (-1 != peer)
+        {
+            admin_session(admin, peer);
+            close(peer);
+        }
+    }
+
+    return NULL;
+}
+
+admin_t *admin_init(const char *const path)
+{
+    struct sockaddr_un address;
+
+    if (NULL == path)
+        return errno = ERROR_ADMIN_NULL, NULL;
+
+    if (0 == *path || sizeof(address.sun_path) <= strlen(path))
+        return errno = ERROR_ADMIN_SOCKET, NULL;
+
+    admin_t *admin = malloc(sizeof(admin_t));
+
+    if (NULL == admin)
+        return errno = ERROR_ADMIN_ALLOCATION, NULL;
+
+    admin->listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    admin->stop = eventfd(0, EFD_CLOEXEC);
+    admin->started = 0;
+    admin->server = NULL;
+
+    int rc = EXIT_SUCCESS;
+    struct stat info;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if (-1 == admin->listen || -1 == admin->stop)
+        rc = ERROR_ADMIN_ALLOCATION;
+
+    if (EXIT_SUCCESS == rc && 0 == lstat(path, &info)
+        && S_ISSOCK(info.st_mode))
+        unlink(path);
+
+    // No thread is running yet, so mask of process may be changed for bind
+    if (EXIT_SUCCESS == rc)
+    {
+        mode_t mask = umask(S_IRWXG | S_IRWXO);
+
+        if (-1 == bind(admin->listen, (struct sockaddr *)&address,
+                       sizeof(address))
+            || -1 == listen(admin->listen, 4))
+            rc = ERROR_ADMIN_SOCKET;
+
+        umask(mask);
+    }
+
+    if (EXIT_SUCCESS != rc)
+    {
+        LOG_F(ERROR, "Unable to listen for commands on \"%s\"", path);
+        admin_free(&admin);
+        errno = rc;
+    }
+
+    return admin;
+}
+
+int admin_start(admin_t *const admin, server_t *const server)
+{
+    if (NULL == admin || NULL == server)
+        return ERROR_ADMIN_NULL;
+
+    admin->server = server;
+
+    if (EXIT_SUCCESS != pthread_create(&admin->thread, NULL, admin_main,
+                                       admin))
+        return ERROR_ADMIN_THREAD;
+
+    admin->started = 1;
+
+    return EXIT_SUCCESS;
+}
+
+void admin_free(admin_t **const admin)
+{
+    if (NULL == admin || NULL == *admin)
+        return;
+
+    uint64_t value = 1;
+
+    if ((*admin)->started
+        && sizeof(value) == write((*admin)->stop, &value, sizeof(value)))
+        pthread_join((*admin)->thread, NULL);
+
+    if (-1 != (*admin)->listen)
+        close((*admin)->listen);
+
+    if (-1 != (*admin)->stop)
+        close((*admin)->stop);
+
+    free(*admin);
+    *admin = NULL;
+}
+
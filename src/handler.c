@@ -1,9 +1,14 @@
 #include "handler.h"
 #include "list.h"
 
+// Immediate handlers, that precede every other one, are kept apart as well,
+// since only they may be found without checking the rest
 struct _handler_list
 {
     list_t *list;
+    list_t *immediate;
+    size_t leading;
+    int ordinary;
 };
 
 struct _handler_call
@@ -14,6 +19,9 @@ struct _handler_call
 
 static int handler_check(const handler_t *const handler);
 static int handler_find(const void *const arg, const void *const value);
+static int handler_search(const list_t *const list,
+                          const request_t *const request,
+                          handler_call_t *const call);
 
 handler_call_t *handler_call_init(void)
 {
@@ -57,9 +65,18 @@ handler_list_t *handler_list_init(void)
         return errno = ERROR_HANDLER_LIST_ALLOCATION, NULL;
 
     out->list = list_init(sizeof(handler_t));
+    out->immediate = list_init(sizeof(handler_t));
+    out->leading = 0;
+    out->ordinary = 0;
+
+    if (NULL == out->list || NULL == out->immediate)
+    {
+        list_free(&out->list);
+        list_free(&out->immediate);
+        free(out);
 
-    if (NULL == out)
         return errno = ERROR_HANDLER_LIST_ALLOCATION, NULL;
+    }
 
     return out;
 }
@@ -74,10 +91,22 @@ int handler_list_push(handler_list_t *list, const handler_t *const handler)
     if (EXIT_SUCCESS != rc)
         return rc;
 
-    if (NULL == list->list)
+    if (NULL == list->list || NULL == list->immediate)
         return ERROR_HANDLER_LIST_INVALID_ITEM;
 
-    return list_push_back(list->list, handler);
+    rc = list_push_back(list->list, handler);
+
+    if (!handler->immediate)
+        list->ordinary = 1;
+
+    // Copy doesn't own argument, it is freed through the main list only
+    if (EXIT_SUCCESS == rc && !list->ordinary)
+        rc = list_push_back(list->immediate, handler);
+
+    if (EXIT_SUCCESS == rc && !list->ordinary)
+        list->leading++;
+
+    return rc;
 }
 
 int handler_list_find(handler_list_t *list, const request_t *const request,
@@ -86,23 +115,25 @@ int handler_list_find(handler_list_t *list, const request_t *const request,
     if (NULL == list || NULL == request || NULL == call)
         return ERROR_HANDLER_LIST_NULL;
 
-    if (NULL == list->list)
-        return ERROR_HANDLER_LIST_INVALID_ITEM;
-
-    handler_t *found;
-    list_filter_t filter = {handler_find, request};
-    int rc = list_find(list->list, &filter, (void **)&found);
+    return handler_search(list->list, request, call);
+}
 
-    if (EXIT_SUCCESS != rc)
-        return ERROR_HANDLER_LIST_INVALID_ITEM;
+int handler_list_find_immediate(handler_list_t *list,
+                                const request_t *const request,
+                                handler_call_t *const call)
+{
+    if (NULL == list || NULL == request || NULL == call)
+        return ERROR_HANDLER_LIST_NULL;
 
-    if (NULL == found)
-        return ERROR_HANDLER_LIST_NOT_FOUND;
+    return handler_search(list->immediate, request, call);
+}
 
-    call->function = found->function;
-    call->arg = found->arg;
+size_t handler_list_immediate(const handler_list_t *const list)
+{
+    if (NULL == list)
+        return 0;
 
-    return EXIT_SUCCESS;
+    return list->leading;
 }
 
 void handler_list_free(handler_list_t **list)
@@ -128,6 +159,7 @@ void handler_list_free(handler_list_t **list)
     list_iterator_free(&end);
 
     list_free(&(*list)->list);
+    list_free(&(*list)->immediate);
     free(*list);
     *list = NULL;
 }
@@ -151,3 +183,25 @@ static int handler_find(const void *const arg, const void *const value)
     return ((const handler_t *)value)->check((const request_t *)arg);
 }
 
+static int handler_search(const list_t *const list,
+                          const request_t *const request,
+                          handler_call_t *const call)
+{
+    if (NULL == list)
+        return ERROR_HANDLER_LIST_INVALID_ITEM;
+
+    handler_t *found;
+    list_filter_t filter = {handler_find, request};
+    int rc = list_find(list, &filter, (void **)&found);
+
+    if (EXIT_SUCCESS != rc)
+        return ERROR_HANDLER_LIST_INVALID_ITEM;
+
+    if (NULL == found)
+        return ERROR_HANDLER_LIST_NOT_FOUND;
+
+    call->function = found->function;
+    call->arg = found->arg;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include "limiter.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+
+#include "timer_wheel.h"
+
+#define LIMITER_SHARDS  64
+#define LIMITER_BUCKETS 256
+// Clients tracked at most by one shard. Idle ones are dropped, once it fills.
+#define LIMITER_ENTRIES 1024
+
+// Tokens are counted in thousandths, so refill of a millisecond equals rate
+#define LIMITER_TOKEN 1000
+
+#define LIMITER_KEY 16
+
+typedef struct _limiter_entry limiter_entry_t;
+
+struct _limiter_entry
+{
+    limiter_entry_t *next;
+    unsigned char key[LIMITER_KEY];
+    size_t shard;
+    size_t connections;
+    size_t tokens;
+    size_t stamp;
+};
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    limiter_entry_t *buckets[LIMITER_BUCKETS];
+    size_t size;
+} limiter_shard_t;
+
+struct _limiter
+{
+    limiter_limits_t limits;
+    size_t capacity;
+    uint64_t seed;
+    // Entry of every counted connection by descriptor
+    limiter_entry_t **fds;
+    size_t fds_size;
+    size_t shards_init;
+    limiter_shard_t shards[LIMITER_SHARDS];
+};
+
+// IPv4 address is stored mapped to IPv6, so that it matches the same client
+// on dual stack listener. Returns 0 for peer, that isn't limited.
+static int limiter_key(const struct sockaddr *const address,
+                       const socklen_t len, unsigned char *const key)
+{
+    memset(key, 0, LIMITER_KEY);
+
+    if (NULL == address)
+        return 0;
+
+    if (AF_INET == address->sa_family
+        && sizeof(struct sockaddr_in) <= (size_t)len)
+    {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)address;
+
+        key[10] = 0xFF;
+        key[11] = 0xFF;
+        memcpy(key + 12, &in->sin_addr, 4);
+
+        return 1;
+    }
+
+    if (AF_INET6 == address->sa_family
+        && sizeof(struct sockaddr_in6) <= (size_t)len)
+    {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)address;
+
+        memcpy(key, &in6->sin6_addr,
+               IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr) ? LIMITER_KEY
+                                                     : LIMITER_KEY / 2);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// FNV-1a, seeded per table, so that clients can't pick colliding addresses
+static uint64_t limiter_hash(const limiter_t *const limiter,
+                             const unsigned char *const key)
+{
+    uint64_t hash = 14695981039346656037ULL ^ limiter->seed;
+
+    for (size_t i = 0; LIMITER_KEY > i; i++)
+        hash = (hash ^ key[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+static void limiter_refill(const limiter_t *const limiter,
+                           limiter_entry_t *const entry, const size_t now)
+{
+    if (now <= entry->stamp)
+        return;
+
+    size_t elapsed = now - entry->stamp;
+
+    if (limiter->capacity / limiter->limits.rate < elapsed
+        || limiter->capacity - entry->tokens
+           <= elapsed * limiter->limits.rate)
+        entry->tokens = limiter->capacity;
+    else
+        entry->tokens += elapsed * limiter->limits.rate;
+
+    entry->stamp = now;
+}
+
+// Entry without connections and with full bucket holds nothing, that a new
+// one wouldn't
+static int limiter_idle(const limiter_t *const limiter,
+                        limiter_entry_t *const entry, const size_t now)
+{
+    if (0 != entry->connections)
+        return 0;
+
+    if (0 == limiter->limits.rate)
+        return 1;
+
+    limiter_refill(limiter, entry, now);
+
+    return limiter->capacity == entry->tokens;
+}
+
+// Idle entries of chain are dropped on the way
+static limiter_entry_t *limiter_chain(const limiter_t *const limiter,
+                                      limiter_shard_t *const shard,
+                                      limiter_entry_t **link,
+                                      const unsigned char *const key,
+                                      const size_t now)
+{
+    limiter_entry_t *found = NULL;
+
+    while (NULL != *link)
+    {
+        limiter_entry_t *entry = *link;
+
+        if (NULL == found && !memcmp(entry->key, key, LIMITER_KEY))
+        {
+            found = entry;
+            link = &entry->next;
+        }
+        else if (limiter_idle(limiter, entry, now))
+        {
+            *link = entry->next;
+            shard->size--;
+            free(entry);
+        }
+        else
+            link = &entry->next;
+    }
+
+    return found;
+}
+
+static void limiter_prune(const limiter_t *const limiter,
+                          limiter_shard_t *const shard, const size_t now)
+{
+    static const unsigned char none[LIMITER_KEY] = {0};
+
+    for (size_t i = 0; LIMITER_BUCKETS > i; i++)
+        limiter_chain(limiter, shard, shard->buckets + i, none, now);
+}
+
+// Shard has to be locked. NULL is returned, when shard is full of clients,
+// that aren't idle.
+static limiter_entry_t *limiter_find(const limiter_t *const limiter,
+                                     limiter_shard_t *const shard,
+                                     const uint64_t hash,
+                                     const unsigned char *const key)
+{
+    size_t now = timer_wheel_clock();
+    limiter_entry_t **bucket = shard->buckets
+                               + (hash / LIMITER_SHARDS) % LIMITER_BUCKETS;
+    limiter_entry_t *entry = limiter_chain(limiter, shard, bucket, key, now);
+
+    if (NULL != entry)
+        return entry;
+
+    if (LIMITER_ENTRIES <= shard->size)
+        limiter_prune(limiter, shard, now);
+
+    if (LIMITER_ENTRIES <= shard->size
+        || NULL == (entry = malloc(sizeof(limiter_entry_t))))
+        return NULL;
+
+    memcpy(entry->key, key, LIMITER_KEY);
+    entry->shard = hash % LIMITER_SHARDS;
+    entry->connections = 0;
+    entry->tokens = limiter->capacity;
+    entry->stamp = now;
+    entry->next = *bucket;
+    *bucket = entry;
+    shard->size++;
+
+    return entry;
+}
+
+limiter_t *limiter_init(const limiter_limits_t *const limits)
+{
+    if (NULL == limits)
+        return errno = ERROR_LIMITER_NULL, NULL;
+
+    size_t burst = limits->burst ? limits->burst : limits->rate;
+
+    if (SIZE_MAX / LIMITER_TOKEN < burst)
+        return errno = ERROR_LIMITER_INVALID, NULL;
+
+    struct rlimit limit;
+
+    if (EXIT_SUCCESS != getrlimit(RLIMIT_NOFILE, &limit)
+        || RLIM_INFINITY == limit.rlim_cur)
+        return errno = ERROR_LIMITER_INVALID, NULL;
+
+    limiter_t *limiter = calloc(1, sizeof(limiter_t));
+
+    if (NULL == limiter)
+        return errno = ERROR_LIMITER_ALLOCATION, NULL;
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    limiter->limits = *limits;
+    limiter->capacity = burst * LIMITER_TOKEN;
+    limiter->seed = (uint64_t)now.tv_nsec << 32 ^ (uint64_t)now.tv_sec
+                    ^ (uintptr_t)limiter;
+    limiter->fds = calloc(limit.rlim_cur, sizeof(limiter_entry_t *));
+    limiter->fds_size = limit.rlim_cur;
+
+    int rc = NULL == limiter->fds ? ERROR_LIMITER_ALLOCATION : EXIT_SUCCESS;
+
+    while (EXIT_SUCCESS == rc && LIMITER_SHARDS > limiter->shards_init)
+        if (EXIT_SUCCESS != pthread_mutex_init(
+                &limiter->shards[limiter->shards_init].mutex, NULL))
+            rc = ERROR_LIMITER_ALLOCATION;
+        else
+            limiter->shards_init++;
+
+    if (EXIT_SUCCESS != rc)
+    {
+        limiter_free(&limiter);
+        errno = rc;
+    }
+
+    return limiter;
+}
+
+int limiter_acquire(limiter_t *const limiter, const int fd,
+                    const struct sockaddr *const address, const socklen_t len)
+{
+    unsigned char key[LIMITER_KEY];
+
+    if (NULL == limiter)
+        return ERROR_LIMITER_NULL;
+
+    if (0 > fd || limiter->fds_size <= (size_t)fd
+        || !limiter_key(address, len, key))
+        return EXIT_SUCCESS;
+
+    uint64_t hash = limiter_hash(limiter, key);
+    limiter_shard_t *shard = limiter->shards + hash % LIMITER_SHARDS;
+    limiter_entry_t *entry = NULL;
+    int rc = EXIT_SUCCESS;
+
+    // Client is let through, rather than refused for failure of its own
+    if (EXIT_SUCCESS != pthread_mutex_lock(&shard->mutex))
+        return EXIT_SUCCESS;
+
+    entry = limiter_find(limiter, shard, hash, key);
+
+    if (NULL == entry)
+        ;
+    else if (limiter->limits.connections
+             && limiter->limits.connections <= entry->connections)
+        rc = ERROR_LIMITER_CONNECTIONS;
+    else
+        entry->connections++;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    // Entry with connections is never dropped, so it is safe to keep
+    if (EXIT_SUCCESS == rc && NULL != entry)
+        __atomic_store_n(limiter->fds + fd, entry, __ATOMIC_RELEASE);
+
+    return rc;
+}
+
+int limiter_take(limiter_t *const limiter, const int fd)
+{
+    if (NULL == limiter)
+        return ERROR_LIMITER_NULL;
+
+    if (0 > fd || limiter->fds_size <= (size_t)fd || 0 == limiter->limits.rate)
+        return EXIT_SUCCESS;
+
+    limiter_entry_t *entry = __atomic_load_n(limiter->fds + fd,
+                                             __ATOMIC_ACQUIRE);
+    int rc = EXIT_SUCCESS;
+
+    if (NULL == entry)
+        return EXIT_SUCCESS;
+
+    limiter_shard_t *shard = limiter->shards + entry->shard;
+
+    if (EXIT_SUCCESS != pthread_mutex_lock(&shard->mutex))
+        return EXIT_SUCCESS;
+
+    limiter_refill(limiter, entry, timer_wheel_clock());
+
+    if (LIMITER_TOKEN > entry->tokens)
+        rc = ERROR_LIMITER_RATE;
+    else
+        entry->tokens -= LIMITER_TOKEN;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    return rc;
+}
+
+void limiter_release(limiter_t *const limiter, const int fd)
+{
+    if (NULL == limiter || 0 > fd || limiter->fds_size <= (size_t)fd)
+        return;
+
+    limiter_entry_t *entry = __atomic_exchange_n(limiter->fds + fd, NULL,
+                                                 __ATOMIC_ACQ_REL);
+
+    if (NULL == entry)
+        return;
+
+    limiter_shard_t *shard = limiter->shards + entry->shard;
+
+    if (EXIT_SUCCESS != pthread_mutex_lock(&shard->mutex))
+        return;
+
+    entry->connections--;
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void limiter_free(limiter_t **const limiter)
+{
+    if (NULL == limiter || NULL == *limiter)
+        return;
+
+    for (size_t i = 0; (*limiter)->shards_init > i; i++)
+    {
+        limiter_shard_t *shard = (*limiter)->shards + i;
+
+        for (size_t j = 0; LIMITER_BUCKETS > j; j++)
+            for (limiter_entry_t *entry = shard->buckets[j], *next = NULL;
+                 NULL != entry; entry = next)
+            {
+                next = entry->next;
+                free(entry);
+            }
+
+        pthread_mutex_destroy(&shard->mutex);
+    }
+
+    free((*limiter)->fds);
+    free(*limiter);
+    *limiter = NULL;
+}
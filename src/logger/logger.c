@@ -30,12 +30,17 @@ void _logger_close(void)
         _logger.post(_logger.arg);
 }
 
+void _logger_limit(log_level_t limit)
+{
+    __atomic_store_n(&_logger.limit, limit, __ATOMIC_RELAXED);
+}
+
 void _logger_log(log_level_t level, const char *const format, ...)
 {
     if (NULL == _logger.function)
         return;
 
-    if (_logger.limit <= level)
+    if (__atomic_load_n(&_logger.limit, __ATOMIC_RELAXED) <= level)
         return;
 
     va_list list;
@@ -1,20 +1,25 @@
 #define _POSIX_C_SOURCE 200112L
 #define _DEFAULT_SOURCE
 
-#include <signal.h>
 #include <string.h>
 
 #include "syslog_logger.h"
 
 #include "server.h"
 #include "handler.h"
+#include "admin.h"
 
+#include "dummy_request.h"
 #include "index_request.h"
 #include "partial_file_request.h"
 #include "unknown_request.h"
 
 #include <unistd.h>
 
+#define ARGS_ENDPOINTS 16
+// Long enough for path of unix socket
+#define ARGS_ADDRESS   108
+
 struct args
 {
     int valid;
@@ -22,6 +27,34 @@ struct args
     int port;
     size_t threads;
     log_level_t level;
+    server_engine_t engine;
+    multiplexer_type_t multiplexer;
+    server_mode_t mode;
+    int timeout_set;
+    size_t timeout;
+    int curve_set;
+    server_timeout_curve_t curve;
+    size_t budget;
+    int admission_set;
+    worker_admission_t admission;
+    size_t processes;
+    int upgrade;
+    int affinity;
+    int tuning_set;
+    server_tuning_t tuning;
+    size_t endpoints_size;
+    server_endpoint_t endpoints[ARGS_ENDPOINTS];
+    char addresses[ARGS_ENDPOINTS][ARGS_ADDRESS];
+    const char *admin;
+    int limits_set;
+    limiter_limits_t limits;
+    int deadlines_set;
+    request_limits_t deadlines;
+    int sizes_set;
+    size_t line;
+    size_t header;
+    size_t body;
+    int health;
 };
 
 typedef struct
@@ -88,6 +121,34 @@ arg_res_t args_port(struct args *args, char ***arg, char **end)
     return res;
 }
 
+arg_res_t args_health(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-P", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = NULL;
+        int port = strtol(**arg, &tmp, 10);
+
+        if (0 != *tmp || 0 >= port)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->health = port;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
 arg_res_t args_cwd(struct args *args, char ***arg, char **end)
 {
     arg_res_t res = {0, EXIT_SUCCESS};
@@ -136,17 +197,600 @@ arg_res_t args_log_level(struct args *args, char ***arg, char **end)
     return res;
 }
 
+arg_res_t args_engine(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-e", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        if (!strcmp(**arg, "reactor"))
+            args->engine = SERVER_ENGINE_REACTOR;
+        else if (!strcmp(**arg, "uring"))
+            args->engine = SERVER_ENGINE_URING;
+        else
+            res.rc = EXIT_FAILURE;
+
+        ++(*arg);
+    }
+
+    return res;
+}
+
+arg_res_t args_multiplexer(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-m", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        if (!strcmp(**arg, "epoll"))
+            args->multiplexer = MULTIPLEXER_EPOLL;
+        else if (!strcmp(**arg, "poll"))
+            args->multiplexer = MULTIPLEXER_POLL;
+        else if (!strcmp(**arg, "select"))
+            args->multiplexer = MULTIPLEXER_SELECT;
+        else
+            res.rc = EXIT_FAILURE;
+
+        ++(*arg);
+    }
+
+    return res;
+}
+
+arg_res_t args_mode(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-c", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        if (!strcmp(**arg, "dispatch"))
+            args->mode = SERVER_MODE_DISPATCH;
+        else if (!strcmp(**arg, "sharded"))
+            args->mode = SERVER_MODE_SHARDED;
+        else if (!strcmp(**arg, "leader"))
+            args->mode = SERVER_MODE_LEADER;
+        else
+            res.rc = EXIT_FAILURE;
+
+        ++(*arg);
+    }
+
+    return res;
+}
+
+arg_res_t args_timeout(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-t", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = NULL;
+        size_t timeout = strtoull(**arg, &tmp, 10);
+
+        if (0 != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->timeout = timeout;
+            args->timeout_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+arg_res_t args_budget(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-b", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = NULL;
+        size_t budget = strtoull(**arg, &tmp, 10);
+
+        if (0 != *tmp || 0 == budget)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->budget = budget;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+// low,high,minimum[,capacity]
+arg_res_t args_curve(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-a", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = **arg;
+        server_timeout_curve_t curve = {0, 0, 0, 0};
+
+        curve.low = strtoul(tmp, &tmp, 10);
+
+        if (',' != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+            curve.high = strtoul(tmp + 1, &tmp, 10);
+
+        if (EXIT_SUCCESS == res.rc && ',' != *tmp)
+            res.rc = EXIT_FAILURE;
+        else if (EXIT_SUCCESS == res.rc)
+            curve.minimum = strtoull(tmp + 1, &tmp, 10);
+
+        if (EXIT_SUCCESS == res.rc && ',' == *tmp)
+            curve.capacity = strtoull(tmp + 1, &tmp, 10);
+
+        if (EXIT_SUCCESS == res.rc && 0 != *tmp)
+            res.rc = EXIT_FAILURE;
+
+        if (EXIT_SUCCESS == res.rc)
+        {
+            args->curve = curve;
+            args->curve_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+arg_res_t args_processes(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-f", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = NULL;
+        size_t processes = strtoull(**arg, &tmp, 10);
+
+        if (0 != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->processes = processes;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+arg_res_t args_upgrade(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    (void)end;
+
+    if (strcmp("-u", **arg))
+        return res;
+
+    res.check = 1;
+    args->upgrade = 1;
+    ++(*arg);
+
+    return res;
+}
+
+// Path of admin socket, which is bound before root is changed
+arg_res_t args_admin(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-A", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+        args->admin = *((*arg)++);
+
+    return res;
+}
+
+arg_res_t args_affinity(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    (void)end;
+
+    if (strcmp("-C", **arg))
+        return res;
+
+    res.check = 1;
+    args->affinity = 1;
+    ++(*arg);
+
+    return res;
+}
+
+static int args_address(char *const address, const char *const begin,
+                        const size_t len)
+{
+    if (ARGS_ADDRESS <= len)
+        return EXIT_FAILURE;
+
+    memcpy(address, begin, len);
+    address[len] = 0;
+
+    // Any address is passed as none
+    if (!strcmp(address, "*"))
+        address[0] = 0;
+
+    return EXIT_SUCCESS;
+}
+
+// unix:path, [ipv6]:port[,v6only] or ipv4:port, * stands for any address
+arg_res_t args_endpoint(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-L", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg) || ARGS_ENDPOINTS == args->endpoints_size)
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        const char *spec = **arg, *port = NULL;
+        char *address = args->addresses[args->endpoints_size];
+        server_endpoint_t endpoint = {AF_INET, NULL, 0, 0};
+
+        if (!strncmp(spec, "unix:", 5))
+        {
+            endpoint.family = AF_UNIX;
+            res.rc = args_address(address, spec + 5, strlen(spec + 5));
+        }
+        else if ('[' == *spec)
+        {
+            const char *close = strchr(spec, ']');
+
+            endpoint.family = AF_INET6;
+
+            if (NULL == close || ':' != close[1])
+                res.rc = EXIT_FAILURE;
+            else
+            {
+                res.rc = args_address(address, spec + 1, close - spec - 1);
+                port = close + 2;
+            }
+        }
+        else
+        {
+            const char *colon = strrchr(spec, ':');
+
+            if (NULL == colon)
+                res.rc = EXIT_FAILURE;
+            else
+            {
+                res.rc = args_address(address, spec, colon - spec);
+                port = colon + 1;
+            }
+        }
+
+        if (EXIT_SUCCESS == res.rc && NULL != port)
+        {
+            char *tmp = NULL;
+
+            endpoint.port = strtol(port, &tmp, 10);
+
+            if (port == tmp)
+                res.rc = EXIT_FAILURE;
+            else if (AF_INET6 == endpoint.family && !strcmp(tmp, ",v6only"))
+                endpoint.v6only = 1;
+            else if (0 != *tmp)
+                res.rc = EXIT_FAILURE;
+        }
+
+        if (EXIT_SUCCESS == res.rc)
+        {
+            args->endpoints[args->endpoints_size++] = endpoint;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+static int args_key(const char *const key, const size_t len,
+                    const char *const name)
+{
+    return strlen(name) == len && !strncmp(key, name, len);
+}
+
+// backlog=N,defer=s,fastopen=N,busy=us,cpu in any order and subset
+arg_res_t args_tuning(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-k", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = **arg;
+        server_tuning_t tuning = {0, 0, 0, 0, 0};
+
+        while (EXIT_SUCCESS == res.rc && 0 != *tmp)
+        {
+            int *value = NULL;
+            size_t len = strcspn(tmp, "=,");
+
+            if (args_key(tmp, len, "backlog"))
+                value = &tuning.backlog;
+            else if (args_key(tmp, len, "defer"))
+                value = &tuning.defer_accept;
+            else if (args_key(tmp, len, "fastopen"))
+                value = &tuning.fastopen;
+            else if (args_key(tmp, len, "busy"))
+                value = &tuning.busy_poll;
+            else if (args_key(tmp, len, "cpu"))
+                tuning.incoming_cpu = 1;
+            else
+                res.rc = EXIT_FAILURE;
+
+            tmp += len;
+
+            if (EXIT_SUCCESS == res.rc && NULL != value && '=' != *tmp)
+                res.rc = EXIT_FAILURE;
+            else if (EXIT_SUCCESS == res.rc && NULL != value)
+                *value = strtol(tmp + 1, &tmp, 10);
+
+            if (EXIT_SUCCESS == res.rc && ',' == *tmp)
+                tmp++;
+            else if (EXIT_SUCCESS == res.rc && 0 != *tmp)
+                res.rc = EXIT_FAILURE;
+        }
+
+        if (EXIT_SUCCESS == res.rc)
+        {
+            args->tuning = tuning;
+            args->tuning_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+// target,interval[,deadline]
+arg_res_t args_admission(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-q", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = **arg;
+        worker_admission_t admission = {0, 0, 0};
+
+        admission.target = strtoull(tmp, &tmp, 10);
+
+        if (',' != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+            admission.interval = strtoull(tmp + 1, &tmp, 10);
+
+        if (EXIT_SUCCESS == res.rc && ',' == *tmp)
+            admission.deadline = strtoull(tmp + 1, &tmp, 10);
+
+        if (EXIT_SUCCESS == res.rc && 0 != *tmp)
+            res.rc = EXIT_FAILURE;
+
+        if (EXIT_SUCCESS == res.rc)
+        {
+            args->admission = admission;
+            args->admission_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+// connections[,rate[,burst]] of client address
+arg_res_t args_limits(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-r", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = **arg;
+        limiter_limits_t limits = {0, 0, 0};
+
+        limits.connections = strtoull(tmp, &tmp, 10);
+
+        if (',' == *tmp)
+            limits.rate = strtoull(tmp + 1, &tmp, 10);
+
+        if (',' == *tmp)
+            limits.burst = strtoull(tmp + 1, &tmp, 10);
+
+        if (0 != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->limits = limits;
+            args->limits_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+// timeout[,rate[,grace]] of slow clients, grace is 5 s by default
+arg_res_t args_deadlines(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-s", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = **arg;
+        request_limits_t deadlines = {0, 0, 5000, 0, 0, 0};
+
+        deadlines.timeout = strtoull(tmp, &tmp, 10);
+
+        if (',' == *tmp)
+            deadlines.rate = strtoull(tmp + 1, &tmp, 10);
+
+        if (',' == *tmp)
+            deadlines.grace = strtoull(tmp + 1, &tmp, 10);
+
+        if (0 != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->deadlines = deadlines;
+            args->deadlines_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
+
+// line,header[,body] sizes of request, 0 turns either off, body is 1 MiB by
+// default
+arg_res_t args_sizes(struct args *args, char ***arg, char **end)
+{
+    arg_res_t res = {0, EXIT_SUCCESS};
+
+    if (strcmp("-H", **arg))
+        return res;
+
+    res.check = 1;
+
+    if (end == ++(*arg))
+        res.rc = EXIT_FAILURE;
+    else
+    {
+        char *tmp = **arg;
+        size_t line = strtoull(tmp, &tmp, 10), header = 0, body = 1048576;
+
+        if (',' != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+            header = strtoull(tmp + 1, &tmp, 10);
+
+        if (',' == *tmp)
+            body = strtoull(tmp + 1, &tmp, 10);
+
+        if (EXIT_SUCCESS != res.rc || 0 != *tmp)
+            res.rc = EXIT_FAILURE;
+        else
+        {
+            args->line = line;
+            args->header = header;
+            args->body = body;
+            args->sizes_set = 1;
+            ++(*arg);
+        }
+    }
+
+    return res;
+}
 
 static const arg_parser_t parsers[] =
 {
-    args_thread, args_port, args_cwd, args_log_level
+    args_thread, args_port, args_cwd, args_log_level, args_engine,
+    args_multiplexer, args_mode, args_timeout, args_curve, args_budget,
+    args_admission, args_processes, args_upgrade, args_endpoint, args_tuning,
+    args_affinity, args_admin, args_limits, args_deadlines, args_sizes,
+    args_health
 };
 
 static const size_t psize = sizeof(parsers) / sizeof(parsers[0]);
 
 struct args parse_args(int argc, char **argv)
 {
-    struct args args = {1, ".", 80, 10, INFO};
+    struct args args = {1, ".", 80, 10, INFO, SERVER_ENGINE_REACTOR,
+                        MULTIPLEXER_EPOLL, SERVER_MODE_DISPATCH, 0, 0, 0,
+                        {0, 0, 0, 0}, 0, 0, {0, 0, 0}, 0, 0, 0, 0,
+                        {0, 0, 0, 0, 0}, 0, {{0, NULL, 0, 0}}, {""}, NULL, 0,
+                        {0, 0, 0}, 0, {0, 0, 0, 0, 0, 0}, 0, 0, 0, 0, 0};
     argc--, argv++;
 
     for (char **end = argv + argc; args.valid && argv != end;)
@@ -184,18 +828,6 @@ int set_server_root(const struct args *const args)
 
 server_t *setup_server(const struct args *const args)
 {
-    struct sigaction new_action;
-    new_action.sa_handler = server_termination_handler;
-    sigemptyset(&new_action.sa_mask);
-    new_action.sa_flags = 0;
-
-    if (-1 == sigaction(SIGINT, &new_action, NULL))
-    {
-        LOG_M(ERROR, "Unable to set sigaction");
-
-        return NULL;
-    }
-
     int rc = server_setup();
     server_t *server = NULL;
 
@@ -210,8 +842,69 @@ server_t *setup_server(const struct args *const args)
         }
     }
 
+    if (EXIT_SUCCESS == rc)
+        rc = server_set_engine(server, args->engine);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_set_multiplexer(server, args->multiplexer);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_set_mode(server, args->mode);
+
+    if (EXIT_SUCCESS == rc && args->timeout_set)
+        rc = server_set_timeout(server, args->timeout);
+
+    if (EXIT_SUCCESS == rc && args->curve_set)
+        rc = server_set_timeout_curve(server, &args->curve);
+
+    if (EXIT_SUCCESS == rc && args->budget)
+        rc = server_set_accept_budget(server, args->budget);
+
+    if (EXIT_SUCCESS == rc && args->admission_set)
+        rc = server_set_admission(server, &args->admission);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_set_processes(server, args->processes);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_set_upgrade(server, args->upgrade);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_set_affinity(server, args->affinity);
+
+    if (EXIT_SUCCESS == rc && args->tuning_set)
+        rc = server_set_tuning(server, &args->tuning);
+
+    if (EXIT_SUCCESS == rc && args->limits_set)
+        rc = server_set_limits(server, &args->limits);
+
+    if (EXIT_SUCCESS == rc && args->deadlines_set)
+        rc = server_set_deadlines(server, &args->deadlines);
+
+    if (EXIT_SUCCESS == rc && args->sizes_set)
+        rc = server_set_request_size(server, args->line, args->header,
+                                     args->body);
+
+    // Addresses are pointed to only here, as args are copied around
+    for (size_t i = 0; EXIT_SUCCESS == rc && args->endpoints_size > i; i++)
+    {
+        server_endpoint_t endpoint = args->endpoints[i];
+
+        endpoint.address = args->addresses[i][0] ? args->addresses[i] : NULL;
+        rc = server_add_endpoint(server, &endpoint);
+
+        if (EXIT_SUCCESS != rc)
+            LOG_F(ERROR, "Invalid endpoint %zu", i);
+    }
+
     handler_t handler;
 
+    if (EXIT_SUCCESS == rc)
+    {
+        handler = dummy_request_get();
+        rc = server_register_handler(server, &handler);
+    }
+
     if (EXIT_SUCCESS == rc)
     {
         handler = index_request_get();
@@ -278,6 +971,38 @@ server_t *setup_server(const struct args *const args)
     return server;
 }
 
+// Health checks are answered on a port of their own by a server, that is
+// attached to the site one and shares its workers and loop
+server_t *setup_health(server_t *const server, const struct args *const args)
+{
+    server_t *health = server_init(args->health, 1);
+    int rc = NULL == health ? errno : EXIT_SUCCESS;
+    handler_t handler;
+
+    if (EXIT_SUCCESS == rc)
+    {
+        handler = dummy_request_get();
+        rc = server_register_handler(health, &handler);
+    }
+
+    if (EXIT_SUCCESS == rc)
+    {
+        handler = unknown_request_get();
+        rc = server_register_handler(health, &handler);
+    }
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_attach(server, health);
+
+    if (EXIT_SUCCESS != rc)
+    {
+        LOG_F(ERROR, "Unable to set up health port %d", args->health);
+        server_free(&health);
+    }
+
+    return health;
+}
+
 int main(int argc, char **argv)
 {
     struct args args = parse_args(argc, argv);
@@ -287,16 +1012,44 @@ int main(int argc, char **argv)
 
     SYSLOG_LOGGER_L(args.level);
 
+    admin_t *admin = NULL;
+
+    if (NULL != args.admin && NULL == (admin = admin_init(args.admin)))
+        return EXIT_FAILURE;
+
     if (EXIT_SUCCESS != set_server_root(&args))
+    {
+        admin_free(&admin);
+
         return EXIT_FAILURE;
+    }
 
     server_t *server = setup_server(&args);
 
     if (NULL == server)
+    {
+        admin_free(&admin);
+
         return EXIT_FAILURE;
+    }
+
+    int rc = EXIT_SUCCESS;
+    server_t *health = NULL;
+
+    if (args.health && NULL == (health = setup_health(server, &args)))
+        rc = EXIT_FAILURE;
+
+    if (EXIT_SUCCESS == rc && NULL != admin
+        && EXIT_SUCCESS != (rc = admin_start(admin, server)))
+        LOG_M(ERROR, "Unable to start admin");
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_mainloop(server);
 
-    int rc = server_mainloop(server);
+    // Handlers of attached server are used by the site one till it is freed
+    admin_free(&admin);
     server_free(&server);
+    server_free(&health);
     server_destroy();
 
     LOG_CLOSE();
@@ -1,34 +1,54 @@
 #define _POSIX_C_SOURCE 200112L
 #include "multiplexer.h"
 
-#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <string.h>
 #include <pthread.h>
-#include <sys/time.h>
 #include <unistd.h>
 
-#include "list_misc.h"
+#include "timer_wheel.h"
+#include "multiplexer_backend.h"
 
-typedef struct
-{
-    int fd;
-    int status;
-    struct timeval entered;
-    size_t timeout;
-} socket_status_t;
+#define MAX_EVENTS 1024
+
+// Registry is a table indexed by descriptor. It is split into pages, which
+// are allocated once on first use and never move, so timers embedded into
+// slots stay valid while the table grows.
+#define PAGE_BITS 8
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+typedef multiplexer_slot_t socket_status_t;
 
 struct _multiplexer
 {
-    list_t *sockets;
+    socket_status_t **pages;
+    size_t pages_size;
+    size_t registered;
+    timer_wheel_t *timers;
+    multiplexer_backend_t backend;
+    void *data;
+    socket_status_t wake;
+    int waiting;
+    multiplexer_ready_t ready[MAX_EVENTS];
     pthread_mutex_t mutex;
     int mutex_init;
 };
 
 static int multiplexer_check(const multiplexer_t *multiplexer);
-static int multiplexer_wait_clear(list_t *ready);
-static int multiplexer_wait_main(const multiplexer_t *multiplexer, list_t *ready,
-                                 const size_t timeout);
-
-multiplexer_t *multiplexer_init(void)
+static int multiplexer_wait_main(multiplexer_t *multiplexer,
+                                 multiplexer_event_t *const events,
+                                 const size_t capacity, size_t *const count,
+                                 const int timeout);
+
+static socket_status_t *table_get(const multiplexer_t *multiplexer,
+                                  const int socket);
+static socket_status_t *table_reserve(multiplexer_t *multiplexer,
+                                      const int socket);
+static void multiplexer_notify(multiplexer_t *multiplexer);
+
+multiplexer_t *multiplexer_init(const multiplexer_type_t type)
 {
     multiplexer_t *out = malloc(sizeof(multiplexer_t));
     int rc = EXIT_SUCCESS;
@@ -39,12 +59,48 @@ multiplexer_t *multiplexer_init(void)
     if (EXIT_SUCCESS == rc)
     {
         out->mutex_init = 0;
-        out->sockets = list_init(sizeof(socket_status_t));
-
-        if (!out->sockets)
+        out->data = NULL;
+        out->wake.fd = -1;
+        out->waiting = 0;
+        out->pages = NULL;
+        out->pages_size = 0;
+        out->registered = 0;
+        out->timers = timer_wheel_init();
+
+        if (!out->timers)
             rc = ERROR_MULTIPLEXER_ALLOCATION;
     }
 
+    if (EXIT_SUCCESS == rc)
+    {
+        if (MULTIPLEXER_EPOLL == type)
+            out->backend = epoll_backend_get();
+        else if (MULTIPLEXER_POLL == type)
+            out->backend = poll_backend_get();
+        else if (MULTIPLEXER_SELECT == type)
+            out->backend = select_backend_get();
+        else
+            rc = ERROR_MULTIPLEXER_INVALID;
+    }
+
+    if (EXIT_SUCCESS == rc)
+        rc = out->backend.init(&out->data);
+
+    // Backends, that wait on a copy of their set, are interrupted through
+    // eventfd, which is registered like a regular socket, but has no slot
+    if (EXIT_SUCCESS == rc && NULL != out->backend.prepare)
+    {
+        timer_wheel_entry_init(&out->wake.timer);
+        out->wake.status = READ;
+        out->wake.generation = 0;
+        out->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (-1 == out->wake.fd)
+            rc = ERROR_MULTIPLEXER_POLL_INIT;
+        else
+            rc = out->backend.add(out->data, &out->wake);
+    }
+
     if (EXIT_SUCCESS == rc)
     {
         rc = pthread_mutex_init(&out->mutex, NULL);
@@ -65,33 +121,49 @@ multiplexer_t *multiplexer_init(void)
     return out;
 }
 
-int multiplexer_wait(multiplexer_t *const multiplexer, list_t *ready,
-                     const size_t timeout)
+int multiplexer_wait(multiplexer_t *const multiplexer,
+                     multiplexer_event_t *const events, const size_t capacity,
+                     size_t *const count, const size_t timeout)
 {
     int rc = multiplexer_check(multiplexer);
 
     if (EXIT_SUCCESS != rc)
         return rc;
 
-    if (NULL == ready)
+    if (NULL == events || 0 == capacity || NULL == count)
         return ERROR_MULTIPLEXER_NULL;
 
-    rc = pthread_mutex_lock(&multiplexer->mutex);
+    *count = 0;
 
-    if (EXIT_SUCCESS != rc)
-        rc = ERROR_MULTIPLEXER_MUTEX;
+    // Wait is cut short by the closest connection timeout, so expiration
+    // doesn't depend on the timeout passed
+    size_t next = TIMER_WHEEL_NONE;
+    int mrc = pthread_mutex_lock(&multiplexer->mutex);
 
-    if (EXIT_SUCCESS == rc)
-        rc = multiplexer_wait_clear(ready);
+    if (EXIT_SUCCESS == mrc)
+    {
+        next = timer_wheel_next(multiplexer->timers);
 
-    if (EXIT_SUCCESS == rc)
-        rc = multiplexer_wait_main(multiplexer, ready, timeout);
+        if (NULL != multiplexer->backend.prepare)
+            rc = multiplexer->backend.prepare(multiplexer->data);
 
-    int mrc = pthread_mutex_unlock(&multiplexer->mutex);
+        multiplexer->waiting = EXIT_SUCCESS == rc;
+        mrc = pthread_mutex_unlock(&multiplexer->mutex);
+    }
 
-    if (EXIT_SUCCESS != mrc && EXIT_SUCCESS == rc)
+    if (EXIT_SUCCESS == rc && EXIT_SUCCESS != mrc)
         rc = ERROR_MULTIPLEXER_MUTEX;
 
+    int wait = timeout ? (int)timeout : -1;
+
+    if (TIMER_WHEEL_NONE != next && (-1 == wait || (size_t)wait > next))
+        wait = next;
+
+    // Mutex is not held while waiting, so other threads may add or remove
+    // sockets meanwhile.
+    if (EXIT_SUCCESS == rc)
+        rc = multiplexer_wait_main(multiplexer, events, capacity, count, wait);
+
     return rc;
 }
 
@@ -103,22 +175,42 @@ int multiplexer_add(multiplexer_t *const multiplexer, const int socket,
     if (EXIT_SUCCESS != rc)
         return rc;
 
-    if (0 == socket || 0 == status)
+    if (0 >= socket || 0 == status)
         return ERROR_MULTIPLEXER_NULL;
 
-    if (FD_SETSIZE <= socket)
-        return ERROR_MULTIPLEXER_OVERFLOW;
-
     int mrc = pthread_mutex_lock(&multiplexer->mutex);
-
-    socket_status_t sstatus = {socket, status, {0, 0}, timeout};
-    gettimeofday(&sstatus.entered, NULL);
+    socket_status_t *sstatus = NULL;
 
     if (EXIT_SUCCESS == mrc)
-        rc = list_push_back(multiplexer->sockets, &sstatus);
+    {
+        sstatus = table_reserve(multiplexer, socket);
 
-    if (EXIT_SUCCESS != rc)
-        rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+        if (NULL == sstatus)
+            rc = ERROR_MULTIPLEXER_ALLOCATION;
+        else if (0 != sstatus->status)
+            rc = ERROR_MULTIPLEXER_INVALID;
+    }
+
+    // Every registration gets new generation, so events of a socket, that
+    // was removed in the meantime, are recognised after the wait
+    if (EXIT_SUCCESS == mrc && EXIT_SUCCESS == rc)
+    {
+        sstatus->status = status;
+        sstatus->generation++;
+        rc = multiplexer->backend.add(multiplexer->data, sstatus);
+
+        if (EXIT_SUCCESS != rc)
+            sstatus->status = 0;
+    }
+
+    if (EXIT_SUCCESS == mrc && EXIT_SUCCESS == rc)
+    {
+        multiplexer->registered++;
+        multiplexer_notify(multiplexer);
+
+        if (timeout)
+            rc = timer_wheel_arm(multiplexer->timers, &sstatus->timer, timeout);
+    }
 
     if (EXIT_SUCCESS == mrc)
         mrc = pthread_mutex_unlock(&multiplexer->mutex);
@@ -129,74 +221,71 @@ int multiplexer_add(multiplexer_t *const multiplexer, const int socket,
     return rc;
 }
 
-struct timeout_handler
+static int table_release(multiplexer_t *multiplexer,
+                         socket_status_t *const status)
 {
-    int *rc;
-    struct timeval now;
-    list_t *deleted;
-};
+    int rc = multiplexer->backend.remove(multiplexer->data, status);
 
-static size_t get_diff(const struct timeval *begin, const struct timeval *end)
-{
-    return (end->tv_sec - begin->tv_sec) * 1000
-           + (end->tv_usec - begin->tv_usec) / 1000;
+    timer_wheel_cancel(multiplexer->timers, &status->timer);
+    status->status = 0;
+    multiplexer->registered--;
+    multiplexer_notify(multiplexer);
+
+    return rc;
 }
 
-static int remove_timeout(const void *const arg, const void *const value)
+struct timeout_handler
 {
-    if (NULL == arg || NULL == value)
-        return 0;
-
-    const struct timeout_handler *handler = arg;
-    const socket_status_t *status = value;
-
-    if (EXIT_SUCCESS != *handler->rc)
-        return 0;
+    multiplexer_t *multiplexer;
+    multiplexer_event_t *events;
+    size_t capacity;
+    size_t *count;
+};
 
-    if (0 == status->timeout)
-        return 0;
+static int expire_timeout(void *arg, timer_wheel_entry_t *entry)
+{
+    struct timeout_handler *handler = arg;
+    socket_status_t *status = (socket_status_t *)entry;
 
-    size_t diff = get_diff(&status->entered, &handler->now);
+    if (*handler->count == handler->capacity)
+        return ERROR_MULTIPLEXER_OVERFLOW;
 
-    if (diff < status->timeout)
-        return 0;
+    multiplexer_event_t *event = handler->events + (*handler->count)++;
+    event->fd = status->fd;
+    event->events = TIMEOUT;
 
-    if (EXIT_SUCCESS != list_push_back(handler->deleted, &status->fd))
-        *handler->rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+    table_release(handler->multiplexer, status);
 
-    return 1;
+    return EXIT_SUCCESS;
 }
 
-int multiplexer_timeout(multiplexer_t *const multiplexer, list_t *deleted)
+int multiplexer_timeout(multiplexer_t *const multiplexer,
+                        multiplexer_event_t *const events,
+                        const size_t capacity, size_t *const count)
 {
     int rc = multiplexer_check(multiplexer);
 
     if (EXIT_SUCCESS != rc)
         return rc;
 
-    if (NULL == deleted)
+    if (NULL == events || 0 == capacity || NULL == count)
         return ERROR_MULTIPLEXER_NULL;
 
+    *count = 0;
     rc = pthread_mutex_lock(&multiplexer->mutex);
 
     if (EXIT_SUCCESS != rc)
         rc = ERROR_MULTIPLEXER_MUTEX;
 
-    if (EXIT_SUCCESS == rc)
-        rc = multiplexer_wait_clear(deleted);
-
+    // Only sockets, which timers have run out, are visited. The ones, that
+    // didn't fit, are reported by the next call.
     if (EXIT_SUCCESS == rc)
     {
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        int inrc = EXIT_SUCCESS;
-        struct timeout_handler handler = {&inrc, now, deleted};
-        list_filter_t filter = {remove_timeout, &handler};
-
-        rc = list_remove(multiplexer->sockets, &filter);
+        struct timeout_handler handler = {multiplexer, events, capacity,
+                                          count};
+        timer_wheel_handler_t expire = {expire_timeout, &handler};
 
-        if (EXIT_SUCCESS == rc && EXIT_SUCCESS != inrc)
-            rc = inrc;
+        rc = timer_wheel_expire(multiplexer->timers, &expire);
     }
 
     int mrc = pthread_mutex_unlock(&multiplexer->mutex);
@@ -207,14 +296,6 @@ int multiplexer_timeout(multiplexer_t *const multiplexer, list_t *deleted)
     return rc;
 }
 
-static int remove_socket(const void *const arg, const void *const value)
-{
-    if (NULL == arg || NULL == value)
-        return 0;
-
-    return *(int *)arg == ((socket_status_t *)value)->fd;
-}
-
 int multiplexer_remove(multiplexer_t *const multiplexer, const int socket)
 {
     int rc = multiplexer_check(multiplexer);
@@ -222,18 +303,18 @@ int multiplexer_remove(multiplexer_t *const multiplexer, const int socket)
     if (EXIT_SUCCESS != rc)
         return rc;
 
-    if (0 == socket)
+    if (0 >= socket)
         return ERROR_MULTIPLEXER_NULL;
 
     int mrc = pthread_mutex_lock(&multiplexer->mutex);
 
-    list_filter_t filter = {remove_socket, &socket};
-
     if (EXIT_SUCCESS == mrc)
-        rc = list_remove(multiplexer->sockets, &filter);
+    {
+        socket_status_t *status = table_get(multiplexer, socket);
 
-    if (EXIT_SUCCESS != rc)
-        rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+        if (NULL != status && 0 != status->status)
+            rc = table_release(multiplexer, status);
+    }
 
     if (EXIT_SUCCESS == mrc)
         mrc = pthread_mutex_unlock(&multiplexer->mutex);
@@ -244,28 +325,76 @@ int multiplexer_remove(multiplexer_t *const multiplexer, const int socket)
     return rc;
 }
 
-static int close_on_remove(const void *const arg, const void *const value)
+size_t multiplexer_size(multiplexer_t *const multiplexer)
 {
-    if (NULL == value || NULL != arg)
+    if (EXIT_SUCCESS != multiplexer_check(multiplexer))
         return 0;
 
-    close(((const socket_status_t *)value)->fd);
+    size_t size = 0;
+
+    if (EXIT_SUCCESS == pthread_mutex_lock(&multiplexer->mutex))
+    {
+        size = multiplexer->registered;
+        pthread_mutex_unlock(&multiplexer->mutex);
+    }
 
-    return 1;
+    return size;
 }
 
-int multiplexer_clear(multiplexer_t *const multiplexer)
+int multiplexer_shorten(multiplexer_t *const multiplexer, const size_t timeout)
 {
     int rc = multiplexer_check(multiplexer);
 
     if (EXIT_SUCCESS != rc)
         return rc;
 
-    list_filter_t filter = {close_on_remove, NULL};
-    rc = list_remove(multiplexer->sockets, &filter);
+    if (0 == timeout)
+        return ERROR_MULTIPLEXER_NULL;
+
+    if (EXIT_SUCCESS != pthread_mutex_lock(&multiplexer->mutex))
+        return ERROR_MULTIPLEXER_MUTEX;
+
+    size_t limit = timer_wheel_clock() + timeout;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && multiplexer->pages_size > i; i++)
+    {
+        socket_status_t *page = multiplexer->pages[i];
+
+        for (size_t j = 0; NULL != page && PAGE_SIZE > j; j++)
+            if (page[j].timer.armed && limit < page[j].timer.expire)
+            {
+                timer_wheel_cancel(multiplexer->timers, &page[j].timer);
+                rc = timer_wheel_arm(multiplexer->timers, &page[j].timer,
+                                     timeout);
+            }
+    }
+
+    if (EXIT_SUCCESS != pthread_mutex_unlock(&multiplexer->mutex)
+        && EXIT_SUCCESS == rc)
+        rc = ERROR_MULTIPLEXER_MUTEX;
+
+    return rc;
+}
+
+int multiplexer_clear(multiplexer_t *const multiplexer)
+{
+    int rc = multiplexer_check(multiplexer);
 
     if (EXIT_SUCCESS != rc)
-        rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+        return rc;
+
+    for (size_t i = 0; multiplexer->registered && multiplexer->pages_size > i;
+         i++)
+    {
+        socket_status_t *page = multiplexer->pages[i];
+
+        for (size_t j = 0; NULL != page && PAGE_SIZE > j; j++)
+            if (0 != page[j].status)
+            {
+                table_release(multiplexer, page + j);
+                close(page[j].fd);
+            }
+    }
 
     return rc;
 }
@@ -278,7 +407,17 @@ void multiplexer_free(multiplexer_t **multiplexer)
     if ((*multiplexer)->mutex_init)
         pthread_mutex_destroy(&(*multiplexer)->mutex);
 
-    list_free(&(*multiplexer)->sockets);
+    if (NULL != (*multiplexer)->data)
+        (*multiplexer)->backend.free(&(*multiplexer)->data);
+
+    if (-1 != (*multiplexer)->wake.fd)
+        close((*multiplexer)->wake.fd);
+
+    for (size_t i = 0; (*multiplexer)->pages_size > i; i++)
+        free((*multiplexer)->pages[i]);
+
+    free((*multiplexer)->pages);
+    timer_wheel_free(&(*multiplexer)->timers);
     free(*multiplexer);
     *multiplexer = NULL;
 }
@@ -288,7 +427,7 @@ static int multiplexer_check(const multiplexer_t *multiplexer)
     if (NULL == multiplexer)
         return ERROR_MULTIPLEXER_NULL;
 
-    if (NULL == multiplexer->sockets)
+    if (NULL == multiplexer->timers || NULL == multiplexer->data)
         return ERROR_MULTIPLEXER_INVALID;
 
     if (0 == multiplexer->mutex_init)
@@ -297,120 +436,138 @@ static int multiplexer_check(const multiplexer_t *multiplexer)
     return EXIT_SUCCESS;
 }
 
-static int multiplexer_wait_clear(list_t *ready)
+static socket_status_t *table_get(const multiplexer_t *multiplexer,
+                                  const int socket)
 {
-    list_filter_t filter;
-    list_misc_init_remove_all(&filter);
-    int rc = list_remove(ready, &filter);
+    size_t page = (size_t)socket >> PAGE_BITS;
 
-    if (EXIT_SUCCESS != rc)
-        rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+    if (multiplexer->pages_size <= page || NULL == multiplexer->pages[page])
+        return NULL;
 
-    return rc;
+    return multiplexer->pages[page] + (socket & PAGE_MASK);
 }
 
-static int multiplexer_wait_main(const multiplexer_t *multiplexer, list_t *ready,
-                                 const size_t timeout)
+static socket_status_t *table_reserve(multiplexer_t *multiplexer,
+                                      const int socket)
 {
-    int interrupted = 0;
-    int rc = EXIT_SUCCESS;
-    list_iterator_t *iter = list_begin(multiplexer->sockets),
-                    *end = list_end(multiplexer->sockets);
-    fd_set read, write;
-    int max = 0;
-    FD_ZERO(&read);
-    FD_ZERO(&write);
-
-    if (NULL == iter || NULL == end)
-        rc = ERROR_MULTIPLEXER_LIST_OPERATION;
-
-    for (; EXIT_SUCCESS == rc && list_iterator_ne(end, iter);
-         list_iterator_next(iter))
+    size_t page = (size_t)socket >> PAGE_BITS;
+
+    if (multiplexer->pages_size <= page)
     {
-        socket_status_t *status = list_iterator_get(iter);
+        size_t size = multiplexer->pages_size ? multiplexer->pages_size : 4;
 
-        if (NULL == status)
-            rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+        for (; size <= page; size *= 2);
 
-        if (EXIT_SUCCESS == rc)
-        {
-            if (READ & status->status)
-            {
-                FD_SET(status->fd, &read);
-                max = max > status->fd ? max : status->fd;
-            }
+        socket_status_t **tmp = realloc(multiplexer->pages,
+                                        size * sizeof(socket_status_t *));
 
-            if (WRITE & status->status)
-            {
-                FD_SET(status->fd, &write);
-                max = max > status->fd ? max : status->fd;
-            }
-        }
-    }
+        if (NULL == tmp)
+            return NULL;
 
-    list_iterator_free(&iter);
+        memset(tmp + multiplexer->pages_size, 0,
+               (size - multiplexer->pages_size) * sizeof(socket_status_t *));
+        multiplexer->pages = tmp;
+        multiplexer->pages_size = size;
+    }
 
-    if (EXIT_SUCCESS == rc)
+    if (NULL == multiplexer->pages[page])
     {
-        struct timespec *sttimeout = NULL, buf;
+        socket_status_t *slots = malloc(PAGE_SIZE * sizeof(socket_status_t));
 
-        if (timeout)
-        {
-            buf.tv_sec = timeout / 1000;
-            buf.tv_nsec = (timeout % 1000) * 1e6;
-            sttimeout = &buf;
-        }
+        if (NULL == slots)
+            return NULL;
 
-        if (-1 == pselect(max + 1, &read, &write, NULL, sttimeout, NULL))
+        for (size_t i = 0; PAGE_SIZE > i; i++)
         {
-            if (EINTR == errno)
-                interrupted = 1;
-            else
-                rc = ERROR_MULTIPLEXER_SELECT_ERROR;
+            timer_wheel_entry_init(&slots[i].timer);
+            slots[i].fd = (int)((page << PAGE_BITS) + i);
+            slots[i].status = 0;
+            slots[i].generation = 0;
+            slots[i].index = 0;
         }
+
+        multiplexer->pages[page] = slots;
     }
 
-    if (!interrupted && EXIT_SUCCESS == rc)
-    {
-        iter = list_begin(multiplexer->sockets);
+    return multiplexer->pages[page] + (socket & PAGE_MASK);
+}
 
-        if (NULL == iter)
-            rc = ERROR_MULTIPLEXER_LIST_OPERATION;
-    }
+// Waiting thread is interrupted only when some other thread changes the set
+static void multiplexer_notify(multiplexer_t *multiplexer)
+{
+    uint64_t value = 1;
 
-    for (; !interrupted && EXIT_SUCCESS == rc && list_iterator_ne(end, iter);
-         list_iterator_next(iter))
-    {
-        socket_status_t *status = list_iterator_get(iter);
+    if (multiplexer->waiting && -1 != multiplexer->wake.fd
+        && sizeof(value) == write(multiplexer->wake.fd, &value, sizeof(value)))
+        multiplexer->waiting = 0;
+}
+
+static int multiplexer_wait_main(multiplexer_t *multiplexer,
+                                 multiplexer_event_t *const events,
+                                 const size_t capacity, size_t *const count,
+                                 const int timeout)
+{
+    size_t amount = 0;
+    int rc = multiplexer->backend.wait(multiplexer->data, multiplexer->ready,
+                                       MAX_EVENTS < capacity ? MAX_EVENTS
+                                                             : capacity,
+                                       &amount, timeout);
+    int mrc = pthread_mutex_lock(&multiplexer->mutex);
+
+    if (EXIT_SUCCESS == mrc)
+        multiplexer->waiting = 0;
+    else if (EXIT_SUCCESS == rc)
+        rc = ERROR_MULTIPLEXER_MUTEX;
 
-        if (NULL == status)
-            rc = ERROR_MULTIPLEXER_LIST_OPERATION;
+    for (size_t i = 0; EXIT_SUCCESS == rc && amount > i; i++)
+    {
+        const multiplexer_ready_t *event = multiplexer->ready + i;
+        const socket_status_t *status = table_get(multiplexer, event->fd);
+        int is_ready = 1, mask = 0;
 
-        if (EXIT_SUCCESS == rc)
+        // Wake up only resets the counter and is not reported
+        if (event->fd == multiplexer->wake.fd)
         {
-            int is_ready = 1;
+            uint64_t value;
 
-            if (is_ready && READ & status->status
-                && !FD_ISSET(status->fd, &read))
+            read(event->fd, &value, sizeof(value));
+
+            continue;
+        }
+
+        // Socket was removed or replaced after the wait had been started
+        if (NULL == status || 0 == status->status
+            || event->generation != status->generation)
+            is_ready = 0;
+
+        // Error and hang up are reported as ready, so the owner will observe
+        // them on the following read or write
+        if (is_ready && HANGUP & event->events)
+            mask = status->status | HANGUP;
+        else if (is_ready)
+        {
+            if (READ & status->status && !(READ & event->events))
                 is_ready = 0;
 
             if (is_ready && WRITE & status->status
-                && !FD_ISSET(status->fd, &write))
+                && !(WRITE & event->events))
                 is_ready = 0;
 
-            if (is_ready)
-            {
-                rc = list_push_back(ready, &status->fd);
+            mask = status->status;
+        }
 
-                if (EXIT_SUCCESS != rc)
-                    rc = ERROR_MULTIPLEXER_LIST_OPERATION;
-            }
+        if (is_ready)
+        {
+            events[*count].fd = event->fd;
+            events[*count].events = mask;
+            ++*count;
         }
     }
 
-    list_iterator_free(&iter);
-    list_iterator_free(&end);
+    if (EXIT_SUCCESS == mrc
+        && EXIT_SUCCESS != pthread_mutex_unlock(&multiplexer->mutex)
+        && EXIT_SUCCESS == rc)
+        rc = ERROR_MULTIPLEXER_MUTEX;
 
     return rc;
 }
-
@@ -0,0 +1,134 @@
+#include "multiplexer_backend.h"
+
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 1024
+
+typedef struct
+{
+    int epoll;
+    struct epoll_event events[MAX_EVENTS];
+} epoll_backend_t;
+
+static int backend_init(void **const data)
+{
+    epoll_backend_t *backend = malloc(sizeof(epoll_backend_t));
+
+    if (NULL == backend)
+        return ERROR_MULTIPLEXER_ALLOCATION;
+
+    backend->epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    if (-1 == backend->epoll)
+    {
+        free(backend);
+
+        return ERROR_MULTIPLEXER_POLL_INIT;
+    }
+
+    *data = backend;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_add(void *const data, multiplexer_slot_t *const slot)
+{
+    epoll_backend_t *backend = data;
+    struct epoll_event event;
+
+    event.events = 0;
+
+    if (READ & slot->status)
+        event.events |= EPOLLIN;
+
+    if (WRITE & slot->status)
+        event.events |= EPOLLOUT;
+
+    // Generation is kept by the kernel next to descriptor, so events of
+    // a socket removed during wait are recognised afterwards
+    event.data.u64 = (uint64_t)(unsigned)slot->fd
+                     | (uint64_t)slot->generation << 32;
+
+    if (-1 == epoll_ctl(backend->epoll, EPOLL_CTL_ADD, slot->fd, &event))
+        return ENOSPC == errno ? ERROR_MULTIPLEXER_OVERFLOW
+                               : ERROR_MULTIPLEXER_POLL_OPERATION;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_remove(void *const data, multiplexer_slot_t *const slot)
+{
+    epoll_backend_t *backend = data;
+
+    // Socket may be already closed, in which case the kernel has dropped
+    // registration by itself
+    if (-1 == epoll_ctl(backend->epoll, EPOLL_CTL_DEL, slot->fd, NULL)
+        && ENOENT != errno && EBADF != errno)
+        return ERROR_MULTIPLEXER_POLL_OPERATION;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_wait(void *const data, multiplexer_ready_t *const ready,
+                        const size_t capacity, size_t *const count,
+                        const int timeout)
+{
+    epoll_backend_t *backend = data;
+    int amount = epoll_wait(backend->epoll, backend->events,
+                            MAX_EVENTS < capacity ? MAX_EVENTS : capacity,
+                            timeout);
+
+    if (-1 == amount)
+    {
+        if (EINTR != errno)
+            return ERROR_MULTIPLEXER_SELECT_ERROR;
+
+        amount = 0;
+    }
+
+    for (int i = 0; amount > i; i++)
+    {
+        const struct epoll_event *event = backend->events + i;
+        multiplexer_ready_t *current = ready + i;
+
+        current->fd = (int)(event->data.u64 & 0xFFFFFFFF);
+        current->generation = (unsigned)(event->data.u64 >> 32);
+        current->events = 0;
+
+        if (EPOLLIN & event->events)
+            current->events |= READ;
+
+        if (EPOLLOUT & event->events)
+            current->events |= WRITE;
+
+        if ((EPOLLERR | EPOLLHUP) & event->events)
+            current->events |= HANGUP;
+    }
+
+    *count = amount;
+
+    return EXIT_SUCCESS;
+}
+
+static void backend_free(void **const data)
+{
+    epoll_backend_t *backend = *data;
+
+    if (NULL == backend)
+        return;
+
+    close(backend->epoll);
+    free(backend);
+    *data = NULL;
+}
+
+multiplexer_backend_t epoll_backend_get(void)
+{
+    multiplexer_backend_t backend = {backend_init, backend_add, backend_remove,
+                                     NULL, backend_wait, backend_free};
+
+    return backend;
+}
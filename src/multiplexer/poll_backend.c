@@ -0,0 +1,239 @@
+#include "multiplexer_backend.h"
+
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+
+#define INITIAL_CAPACITY 64
+
+// Set is a compacted array of pollfd, which is updated in place on add and
+// remove. Removed entry is replaced by the last one, so the array never has
+// holes and the slot of the moved socket gets its new index.
+typedef struct
+{
+    struct pollfd *fds;
+    unsigned *generations;
+    multiplexer_slot_t **slots;
+    size_t size;
+    size_t capacity;
+    int changed;
+    struct pollfd *snapshot;
+    unsigned *snapshot_generations;
+    size_t snapshot_size;
+    size_t snapshot_capacity;
+} poll_backend_t;
+
+static int backend_init(void **const data)
+{
+    poll_backend_t *backend = calloc(1, sizeof(poll_backend_t));
+
+    if (NULL == backend)
+        return ERROR_MULTIPLEXER_ALLOCATION;
+
+    *data = backend;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_reserve(poll_backend_t *const backend)
+{
+    if (backend->size < backend->capacity)
+        return EXIT_SUCCESS;
+
+    size_t capacity = backend->capacity ? 2 * backend->capacity
+                                        : INITIAL_CAPACITY;
+    struct pollfd *fds = realloc(backend->fds,
+                                 capacity * sizeof(struct pollfd));
+
+    if (NULL == fds)
+        return ERROR_MULTIPLEXER_ALLOCATION;
+
+    backend->fds = fds;
+
+    unsigned *generations = realloc(backend->generations,
+                                    capacity * sizeof(unsigned));
+
+    if (NULL == generations)
+        return ERROR_MULTIPLEXER_ALLOCATION;
+
+    backend->generations = generations;
+
+    multiplexer_slot_t **slots = realloc(backend->slots,
+                                         capacity
+                                         * sizeof(multiplexer_slot_t *));
+
+    if (NULL == slots)
+        return ERROR_MULTIPLEXER_ALLOCATION;
+
+    backend->slots = slots;
+    backend->capacity = capacity;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_add(void *const data, multiplexer_slot_t *const slot)
+{
+    poll_backend_t *backend = data;
+    int rc = backend_reserve(backend);
+
+    if (EXIT_SUCCESS != rc)
+        return rc;
+
+    struct pollfd *fd = backend->fds + backend->size;
+
+    fd->fd = slot->fd;
+    fd->events = 0;
+    fd->revents = 0;
+
+    if (READ & slot->status)
+        fd->events |= POLLIN;
+
+    if (WRITE & slot->status)
+        fd->events |= POLLOUT;
+
+    backend->generations[backend->size] = slot->generation;
+    backend->slots[backend->size] = slot;
+    slot->index = backend->size++;
+    backend->changed = 1;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_remove(void *const data, multiplexer_slot_t *const slot)
+{
+    poll_backend_t *backend = data;
+    size_t index = slot->index;
+
+    if (backend->size <= index || backend->slots[index] != slot)
+        return ERROR_MULTIPLEXER_INVALID;
+
+    size_t last = --backend->size;
+
+    if (index != last)
+    {
+        backend->fds[index] = backend->fds[last];
+        backend->generations[index] = backend->generations[last];
+        backend->slots[index] = backend->slots[last];
+        backend->slots[index]->index = index;
+    }
+
+    backend->changed = 1;
+
+    return EXIT_SUCCESS;
+}
+
+// Waiting thread polls its own copy, which is refreshed only when the set has
+// changed since the previous wait
+static int backend_prepare(void *const data)
+{
+    poll_backend_t *backend = data;
+
+    if (!backend->changed)
+        return EXIT_SUCCESS;
+
+    if (backend->snapshot_capacity < backend->size)
+    {
+        struct pollfd *snapshot = realloc(backend->snapshot,
+                                          backend->capacity
+                                          * sizeof(struct pollfd));
+
+        if (NULL == snapshot)
+            return ERROR_MULTIPLEXER_ALLOCATION;
+
+        backend->snapshot = snapshot;
+
+        unsigned *generations = realloc(backend->snapshot_generations,
+                                        backend->capacity * sizeof(unsigned));
+
+        if (NULL == generations)
+            return ERROR_MULTIPLEXER_ALLOCATION;
+
+        backend->snapshot_generations = generations;
+        backend->snapshot_capacity = backend->capacity;
+    }
+
+    if (backend->size)
+    {
+        memcpy(backend->snapshot, backend->fds,
+               backend->size * sizeof(struct pollfd));
+        memcpy(backend->snapshot_generations, backend->generations,
+               backend->size * sizeof(unsigned));
+    }
+
+    backend->snapshot_size = backend->size;
+    backend->changed = 0;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_wait(void *const data, multiplexer_ready_t *const ready,
+                        const size_t capacity, size_t *const count,
+                        const int timeout)
+{
+    poll_backend_t *backend = data;
+    int amount = poll(backend->snapshot, backend->snapshot_size, timeout);
+
+    if (-1 == amount)
+    {
+        if (EINTR != errno)
+            return ERROR_MULTIPLEXER_SELECT_ERROR;
+
+        amount = 0;
+    }
+
+    *count = 0;
+
+    // Scan stops as soon as every ready descriptor has been seen
+    for (size_t i = 0; amount && capacity > *count
+                       && backend->snapshot_size > i; i++)
+    {
+        const struct pollfd *fd = backend->snapshot + i;
+
+        if (0 == fd->revents)
+            continue;
+
+        multiplexer_ready_t *current = ready + (*count)++;
+
+        current->fd = fd->fd;
+        current->generation = backend->snapshot_generations[i];
+        current->events = 0;
+
+        if (POLLIN & fd->revents)
+            current->events |= READ;
+
+        if (POLLOUT & fd->revents)
+            current->events |= WRITE;
+
+        if ((POLLERR | POLLHUP | POLLNVAL) & fd->revents)
+            current->events |= HANGUP;
+
+        amount--;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void backend_free(void **const data)
+{
+    poll_backend_t *backend = *data;
+
+    if (NULL == backend)
+        return;
+
+    free(backend->fds);
+    free(backend->generations);
+    free(backend->slots);
+    free(backend->snapshot);
+    free(backend->snapshot_generations);
+    free(backend);
+    *data = NULL;
+}
+
+multiplexer_backend_t poll_backend_get(void)
+{
+    multiplexer_backend_t backend = {backend_init, backend_add, backend_remove,
+                                     backend_prepare, backend_wait,
+                                     backend_free};
+
+    return backend;
+}
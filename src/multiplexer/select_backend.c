@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200112L
+#include "multiplexer_backend.h"
+
+#include <sys/select.h>
+#include <string.h>
+#include <errno.h>
+
+// Sets are kept between waits and only updated on add and remove. Descriptors
+// starting from FD_SETSIZE can't be put into fd_set and are refused.
+typedef struct
+{
+    fd_set read;
+    fd_set write;
+    int max;
+    int changed;
+    unsigned generations[FD_SETSIZE];
+    fd_set snapshot_read;
+    fd_set snapshot_write;
+    int snapshot_max;
+    unsigned snapshot_generations[FD_SETSIZE];
+} select_backend_t;
+
+static int backend_init(void **const data)
+{
+    select_backend_t *backend = malloc(sizeof(select_backend_t));
+
+    if (NULL == backend)
+        return ERROR_MULTIPLEXER_ALLOCATION;
+
+    FD_ZERO(&backend->read);
+    FD_ZERO(&backend->write);
+    FD_ZERO(&backend->snapshot_read);
+    FD_ZERO(&backend->snapshot_write);
+    backend->max = -1;
+    backend->snapshot_max = -1;
+    backend->changed = 0;
+    *data = backend;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_add(void *const data, multiplexer_slot_t *const slot)
+{
+    select_backend_t *backend = data;
+
+    if (FD_SETSIZE <= slot->fd)
+        return ERROR_MULTIPLEXER_OVERFLOW;
+
+    if (READ & slot->status)
+        FD_SET(slot->fd, &backend->read);
+
+    if (WRITE & slot->status)
+        FD_SET(slot->fd, &backend->write);
+
+    backend->generations[slot->fd] = slot->generation;
+
+    if (backend->max < slot->fd)
+        backend->max = slot->fd;
+
+    backend->changed = 1;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_remove(void *const data, multiplexer_slot_t *const slot)
+{
+    select_backend_t *backend = data;
+
+    if (FD_SETSIZE <= slot->fd)
+        return ERROR_MULTIPLEXER_INVALID;
+
+    FD_CLR(slot->fd, &backend->read);
+    FD_CLR(slot->fd, &backend->write);
+
+    for (; -1 < backend->max && !FD_ISSET(backend->max, &backend->read)
+           && !FD_ISSET(backend->max, &backend->write); backend->max--);
+
+    backend->changed = 1;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_prepare(void *const data)
+{
+    select_backend_t *backend = data;
+
+    if (!backend->changed)
+        return EXIT_SUCCESS;
+
+    backend->snapshot_read = backend->read;
+    backend->snapshot_write = backend->write;
+    backend->snapshot_max = backend->max;
+
+    if (-1 < backend->max)
+        memcpy(backend->snapshot_generations, backend->generations,
+               (backend->max + 1) * sizeof(unsigned));
+
+    backend->changed = 0;
+
+    return EXIT_SUCCESS;
+}
+
+static int backend_wait(void *const data, multiplexer_ready_t *const ready,
+                        const size_t capacity, size_t *const count,
+                        const int timeout)
+{
+    select_backend_t *backend = data;
+    struct timespec time = {timeout / 1000, timeout % 1000 * 1000000};
+    fd_set read, write;
+
+    // Sets are overwritten with the result, so they are copied once more on
+    // every wait
+    read = backend->snapshot_read;
+    write = backend->snapshot_write;
+
+    int amount = pselect(backend->snapshot_max + 1, &read, &write, NULL,
+                         -1 == timeout ? NULL : &time, NULL);
+
+    // Descriptor may be removed and closed by another thread after prepare.
+    // Such wait is spurious, as removal has marked sets changed, so they are
+    // taken anew on the next prepare.
+    if (-1 == amount)
+    {
+        if (EINTR != errno && EBADF != errno)
+            return ERROR_MULTIPLEXER_SELECT_ERROR;
+
+        amount = 0;
+    }
+
+    *count = 0;
+
+    for (int fd = 0; amount && capacity > *count
+                     && backend->snapshot_max >= fd; fd++)
+    {
+        int events = 0;
+
+        if (FD_ISSET(fd, &read))
+            events |= READ, amount--;
+
+        if (FD_ISSET(fd, &write))
+            events |= WRITE, amount--;
+
+        if (0 == events)
+            continue;
+
+        multiplexer_ready_t *current = ready + (*count)++;
+
+        current->fd = fd;
+        current->generation = backend->snapshot_generations[fd];
+        current->events = events;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void backend_free(void **const data)
+{
+    if (NULL == *data)
+        return;
+
+    free(*data);
+    *data = NULL;
+}
+
+multiplexer_backend_t select_backend_get(void)
+{
+    multiplexer_backend_t backend = {backend_init, backend_add, backend_remove,
+                                     backend_prepare, backend_wait,
+                                     backend_free};
+
+    return backend;
+}
@@ -1,7 +1,11 @@
-#define _POSIX_C_SOURCE 1
+#define _POSIX_C_SOURCE 200112L
 #include "request_parser.h"
 
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/socket.h>
 
 #include "list.h"
@@ -9,10 +13,26 @@
 
 #define INITIAL_SIZE 4096
 
+// Buffer may hold more than one request, when they are pipelined. Bytes of
+// the current one are followed by the rest, which first byte is kept aside
+// while it is replaced by terminating zero of the body.
 struct _request
 {
     char *base;
     size_t size;
+    size_t baseline;
+    size_t length;
+    size_t consumed;
+    char next;
+    int closed;
+    int expired;
+    int slow;
+    int too_long;
+    int too_large;
+    int body_too_large;
+    int malformed;
+    size_t deadline;
+    request_limits_t limits;
 
     list_t *headers;
     list_t *parameters;
@@ -33,8 +53,15 @@ typedef struct
 } parameter_item_t;
 
 static int request_check(const request_t *const request);
-static int request_read_inner(request_t *const request, const int socket, ssize_t *const size);
+static size_t request_clock(void);
+static int request_wait(const int socket, const short events,
+                        const size_t deadline);
+static void request_shrink(request_t *const request);
+static int request_bounded(request_t *const request, const size_t head);
+static int request_read_inner(request_t *const request, const int socket);
 static int request_parse(request_t *const request, const ssize_t size);
+static int request_length(const char *const value, size_t *const length);
+static int request_frame(request_t *const request, const int socket);
 
 request_t *request_blank(const size_t size)
 {
@@ -53,6 +80,24 @@ request_t *request_blank(const size_t size)
     out->title.path = NULL;
     out->title.version = NULL;
     out->size = size;
+    out->baseline = size;
+    out->length = 0;
+    out->consumed = 0;
+    out->next = 0;
+    out->closed = 0;
+    out->expired = 0;
+    out->slow = 0;
+    out->too_long = 0;
+    out->too_large = 0;
+    out->body_too_large = 0;
+    out->malformed = 0;
+    out->deadline = 0;
+    out->limits.timeout = 0;
+    out->limits.rate = 0;
+    out->limits.grace = 0;
+    out->limits.line = 0;
+    out->limits.header = 0;
+    out->limits.body = 0;
 
     int rc = EXIT_SUCCESS;
     out->base = calloc(size, sizeof(char));
@@ -85,6 +130,22 @@ request_t *request_blank(const size_t size)
     return out;
 }
 
+int request_set_limits(request_t *request,
+                       const request_limits_t *const limits)
+{
+    int rc = request_check(request);
+
+    if (EXIT_SUCCESS != rc)
+        return rc;
+
+    if (NULL == limits)
+        return ERROR_REQUEST_PARSER_NULL;
+
+    request->limits = *limits;
+
+    return EXIT_SUCCESS;
+}
+
 request_t *request_read(const int socket)
 {
     request_t *out = request_blank(INITIAL_SIZE);
@@ -103,6 +164,36 @@ request_t *request_read(const int socket)
     return out;
 }
 
+// Previous request is dropped, while bytes received after it are kept
+static void request_shift(request_t *const request)
+{
+    if (0 == request->consumed)
+        return;
+
+    request->base[request->consumed] = request->next;
+    request->length -= request->consumed;
+    memmove(request->base, request->base + request->consumed,
+            request->length);
+    request->consumed = 0;
+}
+
+static int request_clear(request_t *const request)
+{
+    list_filter_t filter;
+    list_misc_init_remove_all(&filter);
+
+    if (EXIT_SUCCESS != list_remove(request->headers, &filter)
+        || EXIT_SUCCESS != list_remove(request->parameters, &filter))
+        return ERROR_REQUEST_PARSER_CLEAR;
+
+    request->body = NULL;
+    request->title.method = NULL;
+    request->title.path = NULL;
+    request->title.version = NULL;
+
+    return EXIT_SUCCESS;
+}
+
 int request_read_exist(request_t *request, const int socket)
 {
     int rc = request_check(request);
@@ -113,23 +204,246 @@ int request_read_exist(request_t *request, const int socket)
     if (0 > socket)
         return ERROR_REQUEST_PARSER_INVALID_SOCKET;
 
-    ssize_t size = 0;
-    list_filter_t filter;
-    list_misc_init_remove_all(&filter);
-    rc = list_remove(request->headers, &filter);
+    request_shift(request);
+    request_shrink(request);
+    request->closed = 0;
+    request->expired = 0;
+    request->slow = 0;
+    request->too_long = 0;
+    request->too_large = 0;
+    request->body_too_large = 0;
+    request->malformed = 0;
+    request->deadline = request->limits.timeout
+                        ? request_clock() + request->limits.timeout : 0;
+    rc = request_clear(request);
+
+    if (EXIT_SUCCESS == rc)
+        rc = request_frame(request, socket);
+
+    return rc;
+}
+
+int request_read_buffer(request_t *request, const char *const data,
+                        const size_t size)
+{
+    int rc = request_check(request);
+
+    if (EXIT_SUCCESS != rc)
+        return rc;
+
+    if (NULL == data)
+        return ERROR_REQUEST_PARSER_NULL;
+
+    request_reset(request);
+    rc = request_append(request, data, size);
+
+    if (EXIT_SUCCESS == rc)
+        rc = request_clear(request);
+
+    // Nothing is received, so the request has to be complete
+    if (EXIT_SUCCESS == rc)
+        rc = request_frame(request, -1);
+
+    return rc;
+}
+
+// Request line is framed as a request without header, so that the rest of
+// data isn't parsed
+int request_read_title(request_t *request, const char *const data,
+                       const size_t size)
+{
+    int rc = request_check(request);
 
     if (EXIT_SUCCESS != rc)
-        rc = ERROR_REQUEST_PARSER_CLEAR;
+        return rc;
+
+    if (NULL == data)
+        return ERROR_REQUEST_PARSER_NULL;
+
+    size_t line = 0;
+
+    for (; line + 1 < size
+           && ('\r' != data[line] || '\n' != data[line + 1]); line++);
+
+    if (line + 1 >= size)
+        return ERROR_REQUEST_PARSER_INCORRECT;
+
+    request_reset(request);
+    rc = request_append(request, data, line + 2);
+
+    if (EXIT_SUCCESS == rc)
+        rc = request_append(request, "\r\n", 2);
+
+    if (EXIT_SUCCESS == rc)
+        rc = request_clear(request);
 
     if (EXIT_SUCCESS == rc)
-        rc = request_read_inner(request, socket, &size);
+        rc = request_frame(request, -1);
+
+    return rc;
+}
+
+int request_append(request_t *request, const char *const data,
+                   const size_t size)
+{
+    int rc = request_check(request);
+
+    if (EXIT_SUCCESS != rc)
+        return rc;
+
+    if (NULL == data)
+        return ERROR_REQUEST_PARSER_NULL;
+
+    request_shift(request);
+
+    // Room for terminating zero is required by parser
+    if (request->length + size >= request->size)
+    {
+        size_t newsize = request->size;
+
+        for (; request->length + size >= newsize; newsize *= 2);
+
+        char *tmp = realloc(request->base, newsize);
+
+        if (NULL == tmp)
+            rc = ERROR_REQUEST_PARSER_ALLOCATION;
+        else
+        {
+            request->base = tmp;
+            request->size = newsize;
+        }
+    }
 
     if (EXIT_SUCCESS == rc)
-        rc = request_parse(request, size);
+    {
+        memcpy(request->base + request->length, data, size);
+        request->length += size;
+    }
 
     return rc;
 }
 
+void request_reset(request_t *request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return;
+
+    request->length = 0;
+    request->consumed = 0;
+    request->closed = 0;
+    request->expired = 0;
+    request->slow = 0;
+    request->too_long = 0;
+    request->too_large = 0;
+    request->body_too_large = 0;
+    request->malformed = 0;
+    request->deadline = 0;
+    request_shrink(request);
+}
+
+size_t request_pending(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->length - request->consumed;
+}
+
+int request_closed(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->closed;
+}
+
+int request_expired(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->expired;
+}
+
+int request_too_long(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->too_long;
+}
+
+int request_too_large(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->too_large;
+}
+
+int request_body_too_large(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->body_too_large;
+}
+
+int request_malformed(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->malformed;
+}
+
+int request_send(const request_t *const request, const int socket,
+                 const void *const data, const size_t size)
+{
+    int rc = request_check(request);
+
+    if (EXIT_SUCCESS != rc)
+        return rc;
+
+    if (NULL == data)
+        return ERROR_REQUEST_PARSER_NULL;
+
+    if (0 == request->limits.rate)
+        return (ssize_t)size == send(socket, data, size, 0)
+               ? EXIT_SUCCESS : ERROR_REQUEST_PARSER_WRITE_ERROR;
+
+    size_t due = request_clock() + request->limits.grace, sent = 0;
+
+    // Every byte sent so far moves deadline of the next one by 1 / rate
+    while (EXIT_SUCCESS == rc && size > sent)
+    {
+        ssize_t out = send(socket, (const char *)data + sent, size - sent,
+                           MSG_DONTWAIT);
+
+        if (0 < out)
+            sent += out;
+        else if (-1 == out && (EAGAIN == errno || EWOULDBLOCK == errno))
+            rc = request_wait(socket, POLLOUT,
+                              due + sent * 1000 / request->limits.rate);
+        else
+            rc = ERROR_REQUEST_PARSER_WRITE_ERROR;
+    }
+
+    // Handlers get request as const, while it is never defined so
+    if (ERROR_REQUEST_PARSER_TIMEOUT == rc && size > sent)
+        ((request_t *)request)->slow = 1;
+
+    return rc;
+}
+
+int request_slow(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request))
+        return 0;
+
+    return request->slow;
+}
+
 static int pfind_by_key(const void *const arg, const void *const value)
 {
     if (NULL == arg || NULL == value)
@@ -224,6 +538,44 @@ const char *request_body(const request_t *const request)
     return request->body;
 }
 
+// Header names are compared regardless of case
+static int ifind_by_key(const void *const arg, const void *const value)
+{
+    if (NULL == arg || NULL == value)
+        return 0;
+
+    return !strcasecmp((char *)arg, ((request_item_t *)value)->key);
+}
+
+static const char *request_header(const request_t *const request,
+                                  const char *const name)
+{
+    list_filter_t filter = {ifind_by_key, name};
+    request_item_t *item = NULL;
+
+    if (EXIT_SUCCESS != list_find(request->headers, &filter, (void **)&item)
+        || NULL == item)
+        return NULL;
+
+    return item->value;
+}
+
+int request_keep_alive(const request_t *const request)
+{
+    if (EXIT_SUCCESS != request_check(request)
+        || NULL == request->title.version)
+        return 0;
+
+    const char *connection = request_header(request, "Connection");
+
+    // Only HTTP/1.1 connections are persistent by default, while HTTP/1.0
+    // ones would require it to be confirmed in response. Chunked body isn't
+    // framed, so the end of such request is unknown.
+    return !strcmp(request->title.version, "HTTP/1.1")
+           && (NULL == connection || strcasecmp(connection, "close"))
+           && NULL == request_header(request, "Transfer-Encoding");
+}
+
 void request_free(request_t **const request)
 {
     if (NULL == request || NULL == *request)
@@ -248,48 +600,207 @@ static int request_check(const request_t *const request)
     return EXIT_SUCCESS;
 }
 
-static int request_read_inner(request_t *const request, const int socket, ssize_t *const size)
+static size_t request_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (size_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Socket is waited for until deadline (ms of request_clock)
+static int request_wait(const int socket, const short events,
+                        const size_t deadline)
+{
+    struct pollfd fd = {socket, events, 0};
+    int ready = 0;
+
+    for (size_t now = request_clock(); 0 == ready && deadline > now;
+         now = request_clock())
+    {
+        ready = poll(&fd, 1, deadline - now);
+
+        if (-1 == ready && EINTR == errno)
+            ready = 0;
+    }
+
+    if (-1 == ready)
+        return ERROR_REQUEST_PARSER_READ_ERROR;
+
+    return 0 < ready ? EXIT_SUCCESS : ERROR_REQUEST_PARSER_TIMEOUT;
+}
+
+// Buffer, that has grown for an outlier, is given back, as soon as what is
+// left of it fits into initial size. It is kept, when realloc fails.
+static void request_shrink(request_t *const request)
 {
-    int rc = EXIT_SUCCESS, exp = 1;
-    ssize_t insize = 0;
-    size_t psize = request->size;
-    size_t newsize = request->size;
+    if (request->baseline >= request->size
+        || request->baseline <= request->length)
+        return;
 
-    char *current = request->base;
-    size_t rest = newsize;
-    size_t res_size = 0;
+    char *tmp = realloc(request->base, request->baseline);
 
-    while (EXIT_SUCCESS == rc && exp)
+    if (NULL != tmp)
     {
-        insize = recv(socket, current, rest, 0);
+        request->base = tmp;
+        request->size = request->baseline;
+    }
+}
+
+// Request line has to end within line bytes and header within header ones.
+// Head is 0, while the end of header isn't received.
+static int request_bounded(request_t *const request, const size_t head)
+{
+    size_t size = head ? head : request->length;
+    size_t line = request->limits.line, header = request->limits.header;
 
-        if (-1 == insize)
+    request->too_long = line && line <= size
+                        && NULL == memchr(request->base, '\n', line);
+    request->too_large = !request->too_long && header
+                         && (head ? header < head : header <= size);
+
+    return request->too_long || request->too_large
+           ? ERROR_REQUEST_PARSER_TOO_LARGE : EXIT_SUCCESS;
+}
+
+// Single receive appends to buffer, which is grown to keep room for
+// terminating zero. Under deadline socket is waited for only, when it has
+// nothing to receive.
+static int request_read_inner(request_t *const request, const int socket)
+{
+    if (0 > socket)
+        return ERROR_REQUEST_PARSER_INCORRECT;
+
+    if (request->length + 1 >= request->size)
+    {
+        size_t newsize = request->size * 2;
+        char *tmp = realloc(request->base, newsize);
+
+        if (NULL == tmp)
+            return ERROR_REQUEST_PARSER_ALLOCATION;
+
+        request->base = tmp;
+        request->size = newsize;
+    }
+
+    int flags = request->deadline ? MSG_DONTWAIT : 0, rc = EXIT_SUCCESS;
+    ssize_t insize = -1;
+
+    while (EXIT_SUCCESS == rc && -1 == insize)
+    {
+        insize = recv(socket, request->base + request->length,
+                      request->size - request->length - 1, flags);
+
+        if (-1 == insize && flags && (EAGAIN == errno || EWOULDBLOCK == errno))
+            rc = request_wait(socket, POLLIN, request->deadline);
+        else if (-1 == insize)
             rc = ERROR_REQUEST_PARSER_READ_ERROR;
-        else
-            res_size += insize;
+    }
 
-        if (insize != (ssize_t)rest)
-            exp = 0;
-        else
-        {
-            psize = newsize;
-            newsize *= 2;
-            char *tmp = realloc(request->base, newsize);
+    if (ERROR_REQUEST_PARSER_TIMEOUT == rc)
+        request->expired = 1;
 
-            if (NULL == tmp)
-                rc = ERROR_REQUEST_PARSER_ALLOCATION;
-            else
-            {
-                rest = psize;
-                request->base = tmp;
-                current = request->base + psize;
-                request->size = newsize;
-            }
+    if (EXIT_SUCCESS != rc)
+        return rc;
+
+    // Connection closed between requests is not an error of the request
+    if (0 == insize)
+    {
+        request->closed = 0 == request->length;
+
+        return ERROR_REQUEST_PARSER_EMPTY_READ;
+    }
+
+    request->length += insize;
+
+    return EXIT_SUCCESS;
+}
+
+// Content-Length is digits only, without sign or spaces, that strtoull would
+// let through
+static int request_length(const char *const value, size_t *const length)
+{
+    const char *current = value;
+
+    *length = 0;
+
+    for (; '0' <= *current && '9' >= *current; current++)
+    {
+        size_t digit = *current - '0';
+
+        if ((SIZE_MAX - digit) / 10 < *length)
+            return ERROR_REQUEST_PARSER_INCORRECT;
+
+        *length = *length * 10 + digit;
+    }
+
+    return current == value || 0 != *current ? ERROR_REQUEST_PARSER_INCORRECT
+                                             : EXIT_SUCCESS;
+}
+
+// Header ends with an empty line and is followed by Content-Length bytes of
+// body, everything after them belongs to the next request. Limits are
+// checked before every receive, so header is never read far beyond them,
+// and body is read only, when it fits.
+static int request_frame(request_t *const request, const int socket)
+{
+    int rc = EXIT_SUCCESS;
+    size_t head = 0;
+
+    for (size_t from = 0; EXIT_SUCCESS == rc && 0 == head;)
+    {
+        for (; 0 == head && request->length >= from + 4; from++)
+            if (!memcmp(request->base + from, "\r\n\r\n", 4))
+                head = from + 4;
+
+        rc = request_bounded(request, head);
+
+        if (EXIT_SUCCESS == rc && 0 == head)
+            rc = request_read_inner(request, socket);
+    }
+
+    // Parser terminates header, which overwrites the first byte after it
+    if (EXIT_SUCCESS == rc)
+    {
+        char first = request->base[head];
+
+        rc = request_parse(request, head);
+        request->base[head] = first;
+    }
+
+    size_t body = 0;
+
+    if (EXIT_SUCCESS == rc)
+    {
+        const char *length = request_header(request, "Content-Length");
+
+        if (NULL != length
+            && (EXIT_SUCCESS != request_length(length, &body)
+                || SIZE_MAX - head <= body))
+        {
+            request->malformed = 1;
+            rc = ERROR_REQUEST_PARSER_INCORRECT;
         }
     }
 
+    // Body, that is declared too large, isn't buffered at all
+    if (EXIT_SUCCESS == rc && request->limits.body
+        && request->limits.body < body)
+    {
+        request->body_too_large = 1;
+        rc = ERROR_REQUEST_PARSER_TOO_LARGE;
+    }
+
+    while (EXIT_SUCCESS == rc && request->length < head + body)
+        rc = request_read_inner(request, socket);
+
     if (EXIT_SUCCESS == rc)
-        *size = res_size;
+    {
+        request->consumed = head + body;
+        request->next = request->base[request->consumed];
+        request->base[request->consumed] = 0;
+    }
 
     return rc;
 }
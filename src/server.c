@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "server.h"
 
 #include <unistd.h>
@@ -5,56 +6,214 @@
 #include <pthread.h>
 #include <memory.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <netinet/tcp.h>
 
 #include "logger.h"
 
 #include "multiplexer.h"
+#include "timer_wheel.h"
 #include "worker.h"
 #include "list.h"
+#include "uring.h"
 
-#define TIMEOUT_MULTIPLEXER 500
 #define TIMEOUT_CONNECTION  5000
 
+// Request has to be received within this long (ms) since it is started to be
+// read, response may fall behind minimum rate by this much
+#define REQUEST_TIMEOUT 10000
+#define REQUEST_GRACE   5000
+
+// Request line, header and body over these (bytes) are refused with 414, 431
+// and 413
+#define REQUEST_LINE   8192
+#define REQUEST_HEADER 65536
+#define REQUEST_BODY   1048576
+
+#define CURVE_LOW     50
+#define CURVE_HIGH    90
+#define CURVE_MINIMUM 1000
+
+#define SERVER_EVENTS 256
+
+// Accept is paused for this long (ms), when process runs out of descriptors
+#define ACCEPT_BACKOFF 100
+// Connections accepted at most on one readiness of listener
+#define ACCEPT_BUDGET  64
+
+// Queue delay of workers (ms), that starts shedding after an interval above
+#define ADMISSION_TARGET   50
+#define ADMISSION_INTERVAL 500
+
+// Child process, that exits sooner than this (ms) after fork, is respawned
+// only once this much time has passed since
+#define PREFORK_BACKOFF 1000
+
+// Abstract unix socket, through which listener is handed over on upgrade. It
+// doesn't depend on root directory, port tells instances apart.
+#define HANDOFF_NAME "c-web-server:%d"
+
+// Connections, that wait for request, when server drains, get this timeout
+// (ms). Shards keep accepting for as long, as their listeners aren't passed
+// to the next instance, which binds its own meanwhile.
+#define DRAIN_TIMEOUT 1000
+
+// Endpoints, that one server listens on at most
+#define SERVER_LISTENERS 16
+
+#define REQUEST_SIZE 4096
+
+#define URING_ENTRIES      256
+#define URING_CONNECTIONS  1024
+#define URING_BUFFER_COUNT 512
+#define URING_BUFFER_SIZE  4096
+#define URING_HEADER_LIMIT 65536
+
+typedef struct
+{
+    struct sockaddr_storage address;
+    socklen_t len;
+    int v6only;
+} server_address_t;
+
+// Listening sockets of one loop, one for every endpoint of server
+typedef struct
+{
+    int fds[SERVER_LISTENERS];
+    size_t size;
+} server_listeners_t;
+
 struct _server
 {
     int init;
     int port;
+    server_address_t endpoints[SERVER_LISTENERS];
+    handler_list_t *routes[SERVER_LISTENERS];
+    size_t endpoints_size;
+    size_t endpoints_own;
+    unsigned char *owners;
+    size_t owners_size;
+    server_t *host;
+    server_tuning_t tuning;
+    int affinity;
+    limiter_limits_t limits;
+    limiter_t *limiter;
+    request_limits_t requests;
     size_t timeout;
+    server_timeout_curve_t curve;
+    size_t capacity;
+    size_t effective;
+    size_t budget;
+    worker_admission_t admission;
+    server_engine_t engine;
+    server_mode_t mode;
+    multiplexer_type_t multiplexer_type;
     size_t max_threads;
+    size_t resize;
+    size_t processes;
     worker_t *workers;
+    size_t workers_capacity;
+    // Workers from max_threads up to this have been stopped on resize and
+    // haven't been reaped yet
+    size_t retired;
+    int looping;
+    server_counters_t counters;
     handler_list_t *list;
     multiplexer_t *multiplexer;
+    int control;
+    int pending;
+    int returned[2];
+    size_t drained;
+    int upgrade;
+    int handoff[2];
+    server_listeners_t handoff_listen;
+    pthread_t handoff_thread;
+};
+
+// Commands delivered to event loops through control eventfd of server
+enum
+{
+    SERVER_CONTROL_STOP   = 1,
+    SERVER_CONTROL_RELOAD = 2,
+    SERVER_CONTROL_WORKER = 4,
+    SERVER_CONTROL_CHILD  = 8,
+    SERVER_CONTROL_DRAIN  = 16,
+    SERVER_CONTROL_RESIZE = 32
 };
 
 typedef struct
 {
-    const server_t *server;
-    int run;
+    server_t *server;
 } server_status_t;
 
 static int setup = 0;
 static list_t *servers = NULL;
 static int setup_mutex = 0;
 static pthread_mutex_t mutex;
+static int signal_fd = -1;
+static int spare_fd = -1;
 
 static int find_status_by_server(const void *const arg, const void *const value);
 
-static server_status_t *status_register(const server_t *const server);
+static server_status_t *status_register(server_t *const server);
 static int status_drop(const server_status_t *const status);
 
 static int setup_threads(server_t *server);
 static int stop_threads(server_t *server);
 
-static int worker_callback(void *arg, int socket);
+static int worker_callback(void *arg, int socket, int keep);
 static void worker_callback_init(server_t *server, worker_callback_t *callback);
 static void worker_error_func(void *arg, int socket, int error);
-static void worker_error_init(worker_error_t *error);
+static void worker_error_init(server_t *server, worker_error_t *error);
 
 static int server_refuse_connection(int socket);
 
+static int server_takeover(const server_t *const server,
+                           server_listeners_t *const listeners);
+static int server_handoff_start(server_t *const server,
+                                const server_listeners_t *const listeners);
+
+// Signals, that are delivered through signalfd. SIGCHLD is only expected by
+// master of prefork mode.
+static void server_signal_set(sigset_t *const set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTERM);
+    sigaddset(set, SIGHUP);
+    sigaddset(set, SIGQUIT);
+    sigaddset(set, SIGCHLD);
+}
+
+// Soft limit of descriptors is raised up to the hard one
+static void server_raise_limit(void)
+{
+    struct rlimit limit;
+
+    if (EXIT_SUCCESS != getrlimit(RLIMIT_NOFILE, &limit))
+        LOG_M(WARNING, "Unable to get descriptor limit");
+    else if (limit.rlim_cur != limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+
+        if (EXIT_SUCCESS != setrlimit(RLIMIT_NOFILE, &limit))
+            LOG_M(WARNING, "Unable to raise descriptor limit");
+    }
+}
+
 int server_setup(void)
 {
     if (setup)
@@ -70,14 +229,50 @@ int server_setup(void)
     if (EXIT_SUCCESS == rc)
         rc = pthread_mutex_init(&mutex, NULL);
 
-    if (EXIT_SUCCESS != rc)
-        server_destroy();
-    else
-    {
-        setup = 1;
+    if (EXIT_SUCCESS == rc)
         setup_mutex = 1;
+
+    // Blocked signals are inherited by threads and processes started
+    // afterwards and are read only from signalfd by event loops
+    sigset_t set;
+
+    server_signal_set(&set);
+
+    if (EXIT_SUCCESS == rc && EXIT_SUCCESS != pthread_sigmask(SIG_BLOCK, &set,
+                                                              NULL))
+        rc = ERROR_SERVER_SIGNAL;
+
+    if (EXIT_SUCCESS == rc)
+    {
+        signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+        if (-1 == signal_fd)
+            rc = ERROR_SERVER_SIGNAL;
+    }
+
+    // Peer may close kept connection at any moment, failed send is reported
+    // with EPIPE instead
+    if (EXIT_SUCCESS == rc && SIG_ERR == signal(SIGPIPE, SIG_IGN))
+        rc = ERROR_SERVER_SIGNAL;
+
+    server_raise_limit();
+
+    // Spare descriptor is given up, when accept fails for lack of them, so
+    // that pending connection could be taken and refused. It needs no path,
+    // as root may be changed before setup.
+    if (EXIT_SUCCESS == rc)
+    {
+        spare_fd = eventfd(0, EFD_CLOEXEC);
+
+        if (-1 == spare_fd)
+            rc = ERROR_SERVER_ALLOCATION;
     }
 
+    setup = 1;
+
+    if (EXIT_SUCCESS != rc)
+        server_destroy();
+
     return rc;
 }
 
@@ -92,36 +287,194 @@ void server_destroy(void)
     if (setup_mutex)
         pthread_mutex_destroy(&mutex);
 
+    if (-1 != signal_fd)
+    {
+        sigset_t set;
+
+        close(signal_fd);
+        server_signal_set(&set);
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    }
+
+    if (-1 != spare_fd)
+        close(spare_fd);
+
     setup = 0;
     setup_mutex = 0;
+    signal_fd = -1;
+    spare_fd = -1;
 }
 
-void server_termination_handler(int signum)
+static int server_control(server_t *const server, const int command)
 {
-    if (SIGINT != signum)
-        return;
+    uint64_t value = 1;
 
-    if (NULL == servers)
-        return;
+    __atomic_fetch_or(&server->pending, command, __ATOMIC_ACQ_REL);
 
-    if (EXIT_SUCCESS != pthread_mutex_lock(&mutex))
-        return;
+    if (sizeof(value) != write(server->control, &value, sizeof(value)))
+        return ERROR_SERVER_WRITE;
 
-    list_iterator_t *iter = list_begin(servers), *end = list_end(servers);
-    server_status_t *status = NULL;
+    return EXIT_SUCCESS;
+}
+
+int server_stop(server_t *const server)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    return server_control(server, SERVER_CONTROL_STOP);
+}
+
+int server_reload(server_t *const server)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    return server_control(server, SERVER_CONTROL_RELOAD);
+}
+
+static int server_running(server_t *const server)
+{
+    return !(SERVER_CONTROL_STOP
+             & __atomic_load_n(&server->pending, __ATOMIC_ACQUIRE));
+}
+
+static int server_draining(server_t *const server)
+{
+    return SERVER_CONTROL_DRAIN
+           & __atomic_load_n(&server->pending, __ATOMIC_ACQUIRE);
+}
+
+// Signals are read by whichever loop is woken up first and forwarded to every
+// running server
+static int server_signal_read(void)
+{
+    struct signalfd_siginfo info;
+    int rc = EXIT_SUCCESS;
+
+    while (EXIT_SUCCESS == rc
+           && sizeof(info) == read(signal_fd, &info, sizeof(info)))
+    {
+        int command = SIGHUP == info.ssi_signo ? SERVER_CONTROL_RELOAD
+                      : SIGCHLD == info.ssi_signo ? SERVER_CONTROL_CHILD
+                      : SIGQUIT == info.ssi_signo ? SERVER_CONTROL_DRAIN
+                      : SERVER_CONTROL_STOP;
+
+        LOG_F(INFO, "Signal %u caught", info.ssi_signo);
+
+        if (EXIT_SUCCESS != pthread_mutex_lock(&mutex))
+            rc = ERROR_SERVER_LOCK;
+
+        list_iterator_t *iter = NULL, *end = NULL;
+
+        if (EXIT_SUCCESS == rc)
+        {
+            iter = list_begin(servers);
+            end = list_end(servers);
+        }
+
+        for (; NULL != iter && list_iterator_ne(iter, end);
+             list_iterator_next(iter))
+        {
+            server_status_t *status = list_iterator_get(iter);
+
+            if (status)
+                server_control(status->server, command);
+        }
+
+        list_iterator_free(&iter);
+        list_iterator_free(&end);
+
+        if (EXIT_SUCCESS == rc && EXIT_SUCCESS != pthread_mutex_unlock(&mutex))
+            rc = ERROR_SERVER_LOCK;
+    }
+
+    return rc;
+}
+
+// Takes every command except stop and drain, which stay pending until the
+// loop is over. Counter is restored on stop, so that every thread waiting on
+// it is woken up.
+static int server_control_take(server_t *const server)
+{
+    uint64_t value = 0;
+
+    if (sizeof(value) != read(server->control, &value, sizeof(value)))
+        value = 0;
+
+    int commands = __atomic_fetch_and(&server->pending,
+                                      SERVER_CONTROL_STOP
+                                      | SERVER_CONTROL_DRAIN,
+                                      __ATOMIC_ACQ_REL);
 
-    for (; list_iterator_ne(iter, end); list_iterator_next(iter))
+    if (SERVER_CONTROL_STOP & commands)
+        server_control(server, SERVER_CONTROL_STOP);
+
+    return commands;
+}
+
+static int server_reload_workers(server_t *const server);
+static int server_resize_workers(server_t *const server);
+static int server_reap_workers(server_t *const server);
+
+static int server_is_control(const server_t *const server, const int fd)
+{
+    return signal_fd == fd || server->control == fd;
+}
+
+static int server_process_control(server_t *const server, const int fd)
+{
+    if (signal_fd == fd)
+        return server_signal_read();
+
+    int rc = EXIT_SUCCESS;
+    int commands = server_control_take(server);
+
+    // Only dispatch mode has worker pool
+    if (SERVER_CONTROL_RELOAD & commands)
     {
-        status = list_iterator_get(iter);
+        LOG_M(INFO, "Reload");
 
-        if (status)
-            status->run = 0;
+        if (server->init)
+            rc = server_reload_workers(server);
     }
 
-    list_iterator_free(&iter);
-    list_iterator_free(&end);
+    if (EXIT_SUCCESS == rc && SERVER_CONTROL_RESIZE & commands && server->init)
+        rc = server_resize_workers(server);
 
-    pthread_mutex_unlock(&mutex);
+    if (EXIT_SUCCESS == rc && SERVER_CONTROL_WORKER & commands && server->init)
+        rc = worker_wake_up(server->workers, server->max_threads);
+
+    if (EXIT_SUCCESS == rc && SERVER_CONTROL_WORKER & commands && server->init)
+        rc = server_reap_workers(server);
+
+    return rc;
+}
+
+static int server_control_register(server_t *const server,
+                                   multiplexer_t *const multiplexer)
+{
+    int rc = multiplexer_add(multiplexer, server->control, READ, 0);
+
+    if (EXIT_SUCCESS == rc)
+        rc = multiplexer_add(multiplexer, signal_fd, READ, 0);
+
+    if (EXIT_SUCCESS != rc)
+    {
+        LOG_M(ERROR, "Unable to add control channel to pool");
+        rc = ERROR_SERVER_MULTIPLEXING;
+    }
+
+    return rc;
+}
+
+// Control descriptors are shared, so they are taken out of pool before it
+// is cleared
+static void server_control_unregister(server_t *const server,
+                                      multiplexer_t *const multiplexer)
+{
+    multiplexer_remove(multiplexer, server->control);
+    multiplexer_remove(multiplexer, signal_fd);
 }
 
 server_t *server_init(int port, size_t max_threads)
@@ -139,16 +492,72 @@ server_t *server_init(int port, size_t max_threads)
 
     server->init = 0;
     server->port = port;
+    server->endpoints_size = 0;
+    server->endpoints_own = 0;
+    server->owners = NULL;
+    server->owners_size = 0;
+    server->host = NULL;
+    server->tuning.backlog = 0;
+    server->tuning.defer_accept = 0;
+    server->tuning.fastopen = 0;
+    server->tuning.incoming_cpu = 0;
+    server->tuning.busy_poll = 0;
+    server->affinity = 0;
+    server->limits.connections = 0;
+    server->limits.rate = 0;
+    server->limits.burst = 0;
+    server->limiter = NULL;
+    server->requests.timeout = REQUEST_TIMEOUT;
+    server->requests.rate = 0;
+    server->requests.grace = REQUEST_GRACE;
+    server->requests.line = REQUEST_LINE;
+    server->requests.header = REQUEST_HEADER;
+    server->requests.body = REQUEST_BODY;
     server->timeout = TIMEOUT_CONNECTION;
+    server->effective = TIMEOUT_CONNECTION;
+    server->capacity = 0;
+    server->curve.capacity = 0;
+    server->curve.low = CURVE_LOW;
+    server->curve.high = CURVE_HIGH;
+    server->curve.minimum = CURVE_MINIMUM;
+    server->budget = ACCEPT_BUDGET;
+    server->admission.target = ADMISSION_TARGET;
+    server->admission.interval = ADMISSION_INTERVAL;
+    server->admission.deadline = 0;
+    server->engine = SERVER_ENGINE_REACTOR;
+    server->mode = SERVER_MODE_DISPATCH;
+    server->multiplexer_type = MULTIPLEXER_EPOLL;
     server->max_threads = max_threads;
+    server->resize = max_threads;
+    server->workers_capacity = max_threads;
+    server->retired = max_threads;
+    server->looping = 0;
+    server->counters.accepted = 0;
+    server->counters.dispatched = 0;
+    server->counters.served = 0;
+    server->counters.refused = 0;
+    server->counters.limited = 0;
+    server->counters.slow = 0;
+    server->processes = 0;
+    server->drained = 0;
+    server->upgrade = 0;
+    server->handoff[0] = server->handoff[1] = -1;
+    server->handoff_listen.size = 0;
     server->workers = NULL;
     server->list = NULL;
     server->multiplexer = NULL;
+    server->pending = 0;
+    server->control = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    // Connections kept alive by workers are passed back to uring loop here
+    if (-1 == pipe2(server->returned, O_NONBLOCK | O_CLOEXEC))
+        server->returned[0] = server->returned[1] = -1;
 
     server->workers = malloc(worker_size() * max_threads);
     int rc = EXIT_SUCCESS;
 
-    if (NULL == server->workers)
+    if (NULL == server->workers || -1 == server->control
+        || -1 == server->returned[0])
         rc = ERROR_SERVER_ALLOCATION;
 
     if (EXIT_SUCCESS == rc)
@@ -161,7 +570,7 @@ server_t *server_init(int port, size_t max_threads)
 
     if (EXIT_SUCCESS == rc)
     {
-        server->multiplexer = multiplexer_init();
+        server->multiplexer = multiplexer_init(server->multiplexer_type);
 
         if (NULL == server->multiplexer)
             rc = errno;
@@ -173,159 +582,3009 @@ server_t *server_init(int port, size_t max_threads)
     return errno = rc, server;
 }
 
-int server_set_timeout(server_t *const server, size_t timeout)
+int server_set_timeout(server_t *const server, size_t timeout)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    __atomic_store_n(&server->timeout, timeout, __ATOMIC_RELAXED);
+    __atomic_store_n(&server->effective, timeout, __ATOMIC_RELAXED);
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_timeout_curve(server_t *const server,
+                             const server_timeout_curve_t *const curve)
+{
+    if (NULL == server || NULL == curve)
+        return ERROR_SERVER_NULL;
+
+    if (curve->low >= curve->high || 100 < curve->high)
+        return ERROR_SERVER_INVALID;
+
+    server->curve = *curve;
+
+    return EXIT_SUCCESS;
+}
+
+size_t server_get_timeout(const server_t *const server)
+{
+    if (NULL == server)
+        return 0;
+
+    return __atomic_load_n(&server->effective, __ATOMIC_RELAXED);
+}
+
+int server_set_threads(server_t *const server, const size_t threads)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    if (0 == threads)
+        return ERROR_SERVER_ZERO_THREADS;
+
+    int rc = EXIT_SUCCESS, started = __atomic_load_n(&server->init,
+                                                     __ATOMIC_ACQUIRE);
+
+    if (started)
+    {
+        __atomic_store_n(&server->resize, threads, __ATOMIC_RELAXED);
+        rc = server_control(server, SERVER_CONTROL_RESIZE);
+    }
+    else if (__atomic_load_n(&server->looping, __ATOMIC_ACQUIRE))
+        rc = ERROR_SERVER_MODE;
+    else if (threads > server->workers_capacity)
+    {
+        worker_t *workers = realloc(server->workers, worker_size() * threads);
+
+        if (NULL == workers)
+            rc = ERROR_SERVER_ALLOCATION;
+        else
+        {
+            server->workers = workers;
+            server->workers_capacity = threads;
+        }
+    }
+
+    if (EXIT_SUCCESS == rc && !started)
+        server->max_threads = server->resize = server->retired = threads;
+
+    return rc;
+}
+
+size_t server_get_threads(const server_t *const server)
+{
+    if (NULL == server)
+        return 0;
+
+    return __atomic_load_n(&server->max_threads, __ATOMIC_RELAXED);
+}
+
+int server_get_counters(const server_t *const server,
+                        server_counters_t *const counters)
+{
+    if (NULL == server || NULL == counters)
+        return ERROR_SERVER_NULL;
+
+    counters->accepted = __atomic_load_n(&server->counters.accepted,
+                                         __ATOMIC_RELAXED);
+    counters->dispatched = __atomic_load_n(&server->counters.dispatched,
+                                           __ATOMIC_RELAXED);
+    counters->served = __atomic_load_n(&server->counters.served,
+                                       __ATOMIC_RELAXED);
+    counters->refused = __atomic_load_n(&server->counters.refused,
+                                        __ATOMIC_RELAXED);
+    counters->limited = __atomic_load_n(&server->counters.limited,
+                                        __ATOMIC_RELAXED);
+    counters->slow = __atomic_load_n(&server->counters.slow,
+                                     __ATOMIC_RELAXED);
+
+    return EXIT_SUCCESS;
+}
+
+static void server_count(size_t *const counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+// Open descriptors are counted by polling the whole range in chunks, which
+// needs neither /proc, that is gone after chroot, nor a free descriptor. It
+// takes a poll per 1024 descriptors of limit, so it is left to admin stats.
+size_t server_get_headroom(void)
+{
+    struct rlimit limit;
+    struct pollfd fds[1024];
+    size_t open = 0;
+
+    if (EXIT_SUCCESS != getrlimit(RLIMIT_NOFILE, &limit))
+        return 0;
+
+    if (RLIM_INFINITY == limit.rlim_cur)
+        return (size_t)-1;
+
+    const size_t chunk = sizeof(fds) / sizeof(fds[0]);
+
+    for (size_t base = 0; limit.rlim_cur > base; base += chunk)
+    {
+        size_t size = limit.rlim_cur - base < chunk ? limit.rlim_cur - base
+                                                    : chunk;
+
+        for (size_t i = 0; size > i; i++)
+        {
+            fds[i].fd = base + i;
+            fds[i].events = 0;
+        }
+
+        if (-1 == poll(fds, size, 0))
+            return 0;
+
+        for (size_t i = 0; size > i; i++)
+            if (!(POLLNVAL & fds[i].revents))
+                open++;
+    }
+
+    return limit.rlim_cur > open ? limit.rlim_cur - open : 0;
+}
+
+// Descriptor limit is taken as capacity, unless curve sets one
+static void server_resolve_capacity(server_t *const server)
+{
+    struct rlimit limit;
+
+    server->capacity = server->curve.capacity;
+
+    if (0 == server->capacity && 0 == getrlimit(RLIMIT_NOFILE, &limit))
+        server->capacity = RLIM_INFINITY == limit.rlim_cur
+                           ? 0 : limit.rlim_cur;
+}
+
+static size_t server_timeout_at(const server_t *const server,
+                                const size_t connections, const size_t shares)
+{
+    const server_timeout_curve_t *curve = &server->curve;
+    size_t capacity = server->capacity / shares;
+    size_t timeout = __atomic_load_n(&server->timeout, __ATOMIC_RELAXED);
+    size_t minimum = curve->minimum < timeout ? curve->minimum : timeout;
+
+    if (0 == timeout || 0 == capacity)
+        return timeout;
+
+    size_t load = connections * 100 / capacity;
+
+    if (load <= curve->low)
+        return timeout;
+
+    if (load >= curve->high)
+        return minimum;
+
+    return timeout - (timeout - minimum) * (load - curve->low)
+                     / (curve->high - curve->low);
+}
+
+// Timeout for new connections follows occupancy of pool. Connections, that
+// are already waiting, are cut only on notable drop, as it takes a walk over
+// all of them.
+static size_t server_adapt_timeout(server_t *const server,
+                                   multiplexer_t *const multiplexer,
+                                   const size_t shares, size_t *const applied)
+{
+    size_t timeout = server_timeout_at(server, multiplexer_size(multiplexer),
+                                       shares);
+
+    __atomic_store_n(&server->effective, timeout, __ATOMIC_RELAXED);
+
+    if (timeout && timeout + timeout / 4 < *applied)
+    {
+        LOG_F(WARNING, "Connection timeout is cut to %zu ms", timeout);
+
+        if (EXIT_SUCCESS != multiplexer_shorten(multiplexer, timeout))
+            LOG_M(ERROR, "Unable to shorten connection timeouts");
+
+        *applied = timeout;
+    }
+    else if (timeout > *applied)
+        *applied = timeout;
+
+    return timeout;
+}
+
+int server_set_accept_budget(server_t *const server, const size_t budget)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    if (0 == budget)
+        return ERROR_SERVER_INVALID;
+
+    server->budget = budget;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_admission(server_t *const server,
+                         const worker_admission_t *const admission)
+{
+    if (NULL == server || NULL == admission)
+        return ERROR_SERVER_NULL;
+
+    if (admission->target && 0 == admission->interval)
+        return ERROR_SERVER_INVALID;
+
+    server->admission = *admission;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_limits(server_t *const server,
+                      const limiter_limits_t *const limits)
+{
+    if (NULL == server || NULL == limits)
+        return ERROR_SERVER_NULL;
+
+    server->limits = *limits;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_deadlines(server_t *const server,
+                         const request_limits_t *const deadlines)
+{
+    if (NULL == server || NULL == deadlines)
+        return ERROR_SERVER_NULL;
+
+    server->requests.timeout = deadlines->timeout;
+    server->requests.rate = deadlines->rate;
+    server->requests.grace = deadlines->grace;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_request_size(server_t *const server, const size_t line,
+                            const size_t header, const size_t body)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    server->requests.line = line;
+    server->requests.header = header;
+    server->requests.body = body;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_upgrade(server_t *const server, const int upgrade)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    server->upgrade = upgrade;
+
+    return EXIT_SUCCESS;
+}
+
+static int server_address_init(server_address_t *const address,
+                               const server_endpoint_t *const endpoint)
+{
+    int rc = EXIT_SUCCESS;
+
+    memset(address, 0, sizeof(server_address_t));
+    address->v6only = endpoint->v6only;
+
+    if (AF_INET != endpoint->family && AF_INET6 != endpoint->family
+        && AF_UNIX != endpoint->family)
+        rc = ERROR_SERVER_INVALID;
+    else if (AF_UNIX != endpoint->family
+             && (0 > endpoint->port || 65535 < endpoint->port))
+        rc = ERROR_SERVER_INVALID;
+
+    if (EXIT_SUCCESS == rc && AF_INET == endpoint->family)
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&address->address;
+
+        in->sin_family = AF_INET;
+        in->sin_port = htons(endpoint->port);
+        in->sin_addr.s_addr = htonl(INADDR_ANY);
+        address->len = sizeof(struct sockaddr_in);
+
+        if (NULL != endpoint->address
+            && 1 != inet_pton(AF_INET, endpoint->address, &in->sin_addr))
+            rc = ERROR_SERVER_INVALID;
+    }
+    else if (EXIT_SUCCESS == rc && AF_INET6 == endpoint->family)
+    {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&address->address;
+
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(endpoint->port);
+        in6->sin6_addr = in6addr_any;
+        address->len = sizeof(struct sockaddr_in6);
+
+        if (NULL != endpoint->address
+            && 1 != inet_pton(AF_INET6, endpoint->address, &in6->sin6_addr))
+            rc = ERROR_SERVER_INVALID;
+    }
+    else if (EXIT_SUCCESS == rc)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)&address->address;
+
+        if (NULL == endpoint->address || 0 == *endpoint->address
+            || sizeof(un->sun_path) <= strlen(endpoint->address))
+            rc = ERROR_SERVER_INVALID;
+        else
+        {
+            un->sun_family = AF_UNIX;
+            strcpy(un->sun_path, endpoint->address);
+            address->len = sizeof(struct sockaddr_un);
+        }
+    }
+
+    return rc;
+}
+
+// Endpoint is served by handlers of list, which is not necessarily the list
+// of server itself
+static int server_push_endpoint(server_t *const server,
+                                const server_endpoint_t *const endpoint,
+                                handler_list_t *const list)
+{
+    if (SERVER_LISTENERS == server->endpoints_size)
+        return ERROR_SERVER_INVALID;
+
+    int rc = server_address_init(server->endpoints + server->endpoints_size,
+                                 endpoint);
+
+    if (EXIT_SUCCESS == rc)
+        server->routes[server->endpoints_size++] = list;
+
+    return rc;
+}
+
+int server_add_endpoint(server_t *const server,
+                        const server_endpoint_t *const endpoint)
+{
+    if (NULL == server || NULL == endpoint)
+        return ERROR_SERVER_NULL;
+
+    int rc = server_push_endpoint(server, endpoint, server->list);
+
+    if (EXIT_SUCCESS == rc)
+        server->endpoints_own++;
+
+    return rc;
+}
+
+int server_attach(server_t *const server, server_t *const guest)
+{
+    if (NULL == server || NULL == guest)
+        return ERROR_SERVER_NULL;
+
+    if (server == guest || NULL != server->host || NULL != guest->host
+        || server->init || guest->init)
+        return ERROR_SERVER_MODE;
+
+    server_endpoint_t fallback = {AF_INET, NULL, guest->port, 0};
+    size_t size = guest->endpoints_size ? guest->endpoints_size : 1;
+    int rc = EXIT_SUCCESS;
+
+    if (SERVER_LISTENERS - server->endpoints_size < size)
+        rc = ERROR_SERVER_INVALID;
+
+    // Addresses of guest are already checked, so they are copied as they are
+    for (size_t i = 0; EXIT_SUCCESS == rc && guest->endpoints_size > i; i++)
+    {
+        server->endpoints[server->endpoints_size] = guest->endpoints[i];
+        server->routes[server->endpoints_size++] = guest->list;
+    }
+
+    if (EXIT_SUCCESS == rc && 0 == guest->endpoints_size)
+        rc = server_push_endpoint(server, &fallback, guest->list);
+
+    if (EXIT_SUCCESS == rc)
+        guest->host = server;
+
+    return rc;
+}
+
+int server_set_tuning(server_t *const server,
+                      const server_tuning_t *const tuning)
+{
+    if (NULL == server || NULL == tuning)
+        return ERROR_SERVER_NULL;
+
+    if (0 > tuning->backlog || 0 > tuning->defer_accept
+        || 0 > tuning->fastopen || 0 > tuning->busy_poll)
+        return ERROR_SERVER_INVALID;
+
+    server->tuning = *tuning;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_affinity(server_t *const server, const int affinity)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    server->affinity = affinity;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_processes(server_t *const server, const size_t processes)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    server->processes = processes;
+
+    return EXIT_SUCCESS;
+}
+
+// Task, that has waited longer than connection timeout, is not awaited by
+// client any more, so it is the deadline unless set explicitly
+static worker_admission_t server_get_admission(const server_t *const server)
+{
+    worker_admission_t admission = server->admission;
+
+    if (0 == admission.deadline)
+        admission.deadline = server->timeout;
+
+    return admission;
+}
+
+int server_set_engine(server_t *const server, const server_engine_t engine)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    server->engine = engine;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_multiplexer(server_t *const server,
+                           const multiplexer_type_t type)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    multiplexer_t *multiplexer = multiplexer_init(type);
+
+    if (NULL == multiplexer)
+        return ERROR_SERVER_MULTIPLEXING;
+
+    multiplexer_free(&server->multiplexer);
+    server->multiplexer = multiplexer;
+    server->multiplexer_type = type;
+
+    return EXIT_SUCCESS;
+}
+
+int server_set_mode(server_t *const server, const server_mode_t mode)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    server->mode = mode;
+
+    return EXIT_SUCCESS;
+}
+
+int server_register_handler(server_t *const server,
+                            const handler_t *const handler)
+{
+    if (NULL == server)
+        return ERROR_SERVER_NULL;
+
+    return handler_list_push(server->list, handler);
+}
+
+// Connections of attached servers are told apart by listener, they were
+// accepted from. Table is indexed by descriptor and sized by the descriptor
+// limit once, so threads, that accept concurrently, never see it moved.
+static int server_routes_init(server_t *const server)
+{
+    struct rlimit limit;
+    int rc = EXIT_SUCCESS, shared = 0;
+
+    for (size_t i = 0; !shared && server->endpoints_size > i; i++)
+        shared = server->routes[i] != server->list;
+
+    if (!shared || NULL != server->owners)
+        return EXIT_SUCCESS;
+
+    if (EXIT_SUCCESS != getrlimit(RLIMIT_NOFILE, &limit)
+        || RLIM_INFINITY == limit.rlim_cur)
+        rc = ERROR_SERVER_INVALID;
+    else
+    {
+        server->owners = calloc(limit.rlim_cur, sizeof(unsigned char));
+
+        if (NULL == server->owners)
+            rc = ERROR_SERVER_ALLOCATION;
+        else
+            server->owners_size = limit.rlim_cur;
+    }
+
+    if (EXIT_SUCCESS != rc)
+        LOG_M(ERROR, "Unable to allocate routes of attached servers");
+
+    return rc;
+}
+
+static void server_route(const server_t *const server,
+                         const server_listeners_t *const listeners,
+                         const int listen_fd, const int conn_fd)
+{
+    if (NULL == server->owners || server->owners_size <= (size_t)conn_fd)
+        return;
+
+    for (size_t i = 0; listeners->size > i; i++)
+        if (listeners->fds[i] == listen_fd)
+            server->owners[conn_fd] = i;
+}
+
+// Handlers of server, that the connection was accepted for
+static handler_list_t *server_handlers(const server_t *const server,
+                                       const int fd)
+{
+    if (NULL == server->owners || server->owners_size <= (size_t)fd)
+        return server->list;
+
+    return server->routes[server->owners[fd]];
+}
+
+static int server_limiter_init(server_t *const server)
+{
+    if (NULL != server->limiter
+        || (0 == server->limits.connections && 0 == server->limits.rate))
+        return EXIT_SUCCESS;
+
+    server->limiter = limiter_init(&server->limits);
+
+    if (NULL == server->limiter)
+    {
+        LOG_M(ERROR, "Unable to set up limits of clients");
+
+        return errno;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#define LIMIT_RESPONSE                  \
+"HTTP/1.1 429 Too Many Requests\r\n"    \
+"Content-Length: 0\r\n"                 \
+"Connection: close\r\n"                 \
+"\r\n"
+
+// Reply fits into an empty socket buffer, so it is sent without waiting and
+// rejection costs the loop no more than accept and close
+static void server_limit_reply(server_t *const server, const int socket)
+{
+    server_count(&server->counters.limited);
+    send(socket, LIMIT_RESPONSE, sizeof(LIMIT_RESPONSE) - 1, MSG_DONTWAIT);
+}
+
+// Returns 1, when client of connection has no connections left and it has to
+// be closed. Address of peer is looked up, unless it is given by accept.
+static int server_limit_connection(server_t *const server, const int socket,
+                                   const struct sockaddr *address,
+                                   socklen_t len)
+{
+    struct sockaddr_storage peer;
+
+    if (NULL == server->limiter)
+        return 0;
+
+    if (NULL == address)
+    {
+        len = sizeof(peer);
+        address = -1 == getpeername(socket, (struct sockaddr *)&peer, &len)
+                  ? NULL : (struct sockaddr *)&peer;
+    }
+
+    if (EXIT_SUCCESS == limiter_acquire(server->limiter, socket, address, len))
+        return 0;
+
+    LOG_F(INFO, "Socket %d: client is over connection limit", socket);
+    server_limit_reply(server, socket);
+
+    return 1;
+}
+
+// Returns 1, when client of connection has run out of requests and it has to
+// be closed. Request, that is left in socket, is discarded, so that close
+// doesn't reset connection before reply.
+static int server_limit_request(server_t *const server, const int socket)
+{
+    if (NULL == server->limiter
+        || EXIT_SUCCESS == limiter_take(server->limiter, socket))
+        return 0;
+
+    LOG_F(INFO, "Socket %d: client is over request rate", socket);
+    recv(socket, NULL, REQUEST_SIZE, MSG_DONTWAIT | MSG_TRUNC);
+    server_limit_reply(server, socket);
+
+    return 1;
+}
+
+#define TIMEOUT_RESPONSE                \
+"HTTP/1.1 408 Request Timeout\r\n"      \
+"Content-Length: 0\r\n"                 \
+"Connection: close\r\n"                 \
+"\r\n"
+
+// Request, that hasn't been received in time, is answered without waiting,
+// as the client is slow already
+static void server_timeout_reply(server_t *const server, const int socket)
+{
+    server_count(&server->counters.slow);
+    send(socket, TIMEOUT_RESPONSE, sizeof(TIMEOUT_RESPONSE) - 1,
+         MSG_DONTWAIT);
+}
+
+// Every accepted connection is closed through here, so that it isn't counted
+// for its client any longer
+static int server_close(const server_t *const server, const int socket)
+{
+    limiter_release(server->limiter, socket);
+
+    return close(socket);
+}
+
+// CPU, that has processed packets of connection last, -1 if unknown
+static int server_incoming_cpu(const server_t *const server, const int socket)
+{
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+
+    if (!server->affinity
+        || -1 == getsockopt(socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len))
+        cpu = -1;
+
+    return cpu;
+}
+
+// Data, that holds a single whole request matched by an immediate handler,
+// is answered on the loop thread without waking up a worker. Request line is
+// checked first, so that the rest is parsed only for such handler. Returns 1,
+// when it was answered, keep is set then, if connection stays open.
+static int server_answer_inline(server_t *const server,
+                                handler_list_t *const handlers,
+                                request_t *const request,
+                                handler_call_t *const call, const int socket,
+                                const char *const data, const size_t size,
+                                int *const keep)
+{
+    *keep = 0;
+
+    if (NULL == request || NULL == data || 0 == handler_list_immediate(handlers)
+        || EXIT_SUCCESS != request_read_title(request, data, size)
+        || EXIT_SUCCESS != handler_list_find_immediate(handlers, request, call)
+        || EXIT_SUCCESS != request_read_buffer(request, data, size)
+        || 0 != request_pending(request))
+        return 0;
+
+    // Error page isn't sent, as it might block the loop, connection is only
+    // closed
+    if (EXIT_SUCCESS == handler_call(call, socket, request))
+        *keep = request_keep_alive(request);
+    else
+        LOG_F(ERROR, "Socket %d: immediate handler failed", socket);
+
+    server_count(&server->counters.served);
+
+    return 1;
+}
+
+// Request is only peeked at, so that it stays in socket for worker, unless
+// it is answered here
+static int server_peek_inline(server_t *const server,
+                              handler_list_t *const handlers,
+                              request_t *const request,
+                              handler_call_t *const call, const int socket)
+{
+    char buffer[REQUEST_SIZE];
+    int keep = 0;
+
+    if (0 == handler_list_immediate(handlers))
+        return 0;
+
+    ssize_t size = recv(socket, buffer, sizeof(buffer),
+                        MSG_PEEK | MSG_DONTWAIT);
+
+    if (0 >= size || !server_answer_inline(server, handlers, request, call,
+                                           socket, buffer, size, &keep))
+        return 0;
+
+    if (size != recv(socket, buffer, size, MSG_DONTWAIT))
+        keep = 0;
+
+    if (keep && server_running(server) && !server_draining(server)
+        && EXIT_SUCCESS == multiplexer_add(server->multiplexer, socket, READ,
+                                           server_get_timeout(server)))
+        LOG_F(INFO, "Socket %d: answered by loop, kept alive", socket);
+    else if (EXIT_SUCCESS != server_close(server, socket))
+        LOG_F(ERROR, "Socket %d: unable to close", socket);
+
+    return 1;
+}
+
+static int server_process_ready(server_t *const server,
+                                request_t *const request,
+                                handler_call_t *const call, const int socket)
+{
+    int rc = EXIT_SUCCESS, drc = EXIT_SUCCESS, answered = 0;
+    worker_task_t task = {socket, NULL, 0, 0,
+                          server_handlers(server, socket), server->limiter};
+
+    LOG_F(INFO, "Socket %d: ready", socket);
+    // Removed before dispatch, as worker may close socket at any moment after
+    int rrc = multiplexer_remove(server->multiplexer, socket);
+
+    if (EXIT_SUCCESS == rrc && server_limit_request(server, socket))
+        return EXIT_SUCCESS == server_close(server, socket)
+               ? EXIT_SUCCESS : ERROR_SERVER_CLOSE;
+
+    if (EXIT_SUCCESS == rrc)
+        answered = server_peek_inline(server, task.handlers, request, call,
+                                      socket);
+
+    if (!answered)
+        drc = worker_request_dispatch_cpu(server->workers, server->max_threads,
+                                          &task,
+                                          server_incoming_cpu(server, socket));
+
+    if (EXIT_SUCCESS != drc)
+    {
+        LOG_F(WARNING, "Socket %d: connection refused", socket);
+        server_count(&server->counters.refused);
+        rc = server_refuse_connection(socket);
+
+        if (EXIT_SUCCESS != server_close(server, socket))
+            rc = rc ? rc : ERROR_SERVER_CLOSE;
+    }
+    else if (!answered)
+        server_count(&server->counters.dispatched);
+
+    if (EXIT_SUCCESS == rc && answered)
+        LOG_F(INFO, "Socket %d: answered by loop", socket);
+    else if (EXIT_SUCCESS == rc && EXIT_SUCCESS == drc && EXIT_SUCCESS == rrc)
+        LOG_F(INFO, "Socket %d: dispatched and removed from pool", socket);
+    else if (EXIT_SUCCESS != rc)
+        LOG_F(ERROR, "Socket %d: unable to refuse", socket);
+    else if (EXIT_SUCCESS != rrc)
+    {
+        LOG_F(ERROR, "Socket %d: unable to remove socket from pool", socket);
+        rc = rrc;
+    }
+
+    return rc;
+}
+
+// Spare descriptor is closed for a moment to take the pending connection and
+// refuse it, instead of leaving it in backlog
+static void server_shed_connection(const int listen_fd)
+{
+    if (EXIT_SUCCESS != pthread_mutex_lock(&mutex))
+        return;
+
+    if (-1 != spare_fd)
+    {
+        close(spare_fd);
+
+        int conn_fd = accept(listen_fd, NULL, NULL);
+
+        if (-1 != conn_fd)
+        {
+            LOG_F(WARNING, "Socket %d: shed for lack of descriptors", conn_fd);
+            server_refuse_connection(conn_fd);
+            close(conn_fd);
+        }
+
+        spare_fd = eventfd(0, EFD_CLOEXEC);
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+static int server_is_listener(const server_listeners_t *const listeners,
+                              const int fd)
+{
+    for (size_t i = 0; listeners->size > i; i++)
+        if (listeners->fds[i] == fd)
+            return 1;
+
+    return 0;
+}
+
+static int server_listeners_add(multiplexer_t *const multiplexer,
+                                const server_listeners_t *const listeners)
+{
+    int rc = EXIT_SUCCESS;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && listeners->size > i; i++)
+        if (EXIT_SUCCESS != multiplexer_add(multiplexer, listeners->fds[i],
+                                            READ, 0))
+        {
+            LOG_F(ERROR, "Unable to add socket %d to pool",
+                  listeners->fds[i]);
+            rc = ERROR_SERVER_MULTIPLEXING;
+        }
+
+    return rc;
+}
+
+static void server_listeners_remove(multiplexer_t *const multiplexer,
+                                    const server_listeners_t *const listeners)
+{
+    for (size_t i = 0; listeners->size > i; i++)
+        multiplexer_remove(multiplexer, listeners->fds[i]);
+}
+
+static void server_listeners_close(server_listeners_t *const listeners)
+{
+    for (size_t i = 0; listeners->size > i; i++)
+        close(listeners->fds[i]);
+
+    listeners->size = 0;
+}
+
+// Listening sockets are taken out of pool until resume, so that loop doesn't
+// spin on them, while connections can't be accepted
+static void server_pause_accept(multiplexer_t *const multiplexer,
+                                const server_listeners_t *const listeners,
+                                size_t *const resume)
+{
+    LOG_F(WARNING, "Accept paused for %d ms", ACCEPT_BACKOFF);
+
+    server_listeners_remove(multiplexer, listeners);
+    *resume = timer_wheel_clock() + ACCEPT_BACKOFF;
+}
+
+// Returns time left until accept is resumed, 0 if it isn't paused
+static size_t server_resume_accept(multiplexer_t *const multiplexer,
+                                   const server_listeners_t *const listeners,
+                                   size_t *const resume)
+{
+    if (0 == *resume)
+        return 0;
+
+    size_t now = timer_wheel_clock();
+
+    if (now < *resume)
+        return *resume - now;
+
+    if (EXIT_SUCCESS != server_listeners_add(multiplexer, listeners))
+    {
+        server_listeners_remove(multiplexer, listeners);
+        *resume = now + ACCEPT_BACKOFF;
+
+        return ACCEPT_BACKOFF;
+    }
+
+    LOG_M(INFO, "Accept resumed");
+    *resume = 0;
+
+    return 0;
+}
+
+// Failed accept never stops the loop. Lack of descriptors or memory pauses
+// accept for a while, anything else is left to the client.
+static void server_accept_error(multiplexer_t *const multiplexer,
+                                const server_listeners_t *const listeners,
+                                const int listen_fd, size_t *const resume)
+{
+    if (EMFILE == errno || ENFILE == errno)
+    {
+        LOG_M(ERROR, "Unable to accept connection: out of descriptors");
+        server_shed_connection(listen_fd);
+        server_pause_accept(multiplexer, listeners, resume);
+    }
+    else if (ENOBUFS == errno || ENOMEM == errno)
+    {
+        LOG_M(ERROR, "Unable to accept connection: out of memory");
+        server_pause_accept(multiplexer, listeners, resume);
+    }
+    else if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno
+             && ECONNABORTED != errno)
+        LOG_F(WARNING, "Unable to accept connection: %s", strerror(errno));
+}
+
+static int server_accept_add(const server_t *const server,
+                             multiplexer_t *const multiplexer,
+                             const int conn_fd, const size_t timeout)
+{
+    LOG_F(INFO, "New connection: %d", conn_fd);
+
+    int rc = multiplexer_add(multiplexer, conn_fd, READ, timeout);
+
+    if (ERROR_MULTIPLEXER_OVERFLOW == rc)
+    {
+        LOG_F(ERROR, "Socket %d: unable to add to pool. Overflow", conn_fd);
+        // rc = server_refuse_connection(conn_fd);
+        if (EXIT_SUCCESS != server_close(server, conn_fd))
+            rc = ERROR_SERVER_CLOSE;
+        else
+            rc = EXIT_SUCCESS;
+    }
+    else if (EXIT_SUCCESS != rc)
+    {
+        LOG_F(ERROR, "Socket %d: Unable to add to pool. Internal error", conn_fd);
+        // server_refuse_connection(conn_fd);
+        if (EXIT_SUCCESS != server_close(server, conn_fd))
+            rc = ERROR_SERVER_CLOSE;
+        else
+            rc = EXIT_SUCCESS;
+    }
+
+    return rc;
+}
+
+// Listener is drained, until it is empty or budget is spent, so a burst of
+// connections doesn't take a loop iteration per connection. The budget keeps
+// ready sockets and timeouts from waiting behind a long burst.
+static int server_accept(server_t *const server,
+                         multiplexer_t *const multiplexer,
+                         const server_listeners_t *const listeners,
+                         const int listen_fd, const size_t budget,
+                         const size_t timeout, size_t *const resume)
+{
+    int rc = EXIT_SUCCESS, more = 1;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && more && budget > i; i++)
+    {
+        struct sockaddr_storage address;
+        socklen_t len = sizeof(address);
+        int conn_fd = accept4(listen_fd, (struct sockaddr *)&address, &len,
+                              SOCK_CLOEXEC);
+
+        if (-1 != conn_fd)
+            server_count(&server->counters.accepted);
+
+        if (-1 != conn_fd
+            && server_limit_connection(server, conn_fd,
+                                       (struct sockaddr *)&address, len))
+            rc = EXIT_SUCCESS == close(conn_fd) ? EXIT_SUCCESS
+                                                : ERROR_SERVER_CLOSE;
+        else if (-1 != conn_fd)
+        {
+            server_route(server, listeners, listen_fd, conn_fd);
+            rc = server_accept_add(server, multiplexer, conn_fd, timeout);
+        }
+        else
+        {
+            server_accept_error(multiplexer, listeners, listen_fd, resume);
+            more = 0;
+        }
+    }
+
+    return rc;
+}
+
+static int server_process_connections(server_t *const server,
+                                      const server_listeners_t *const listeners,
+                                      request_t *const request,
+                                      handler_call_t *const call,
+                                      const multiplexer_event_t *const events,
+                                      const size_t count,
+                                      const size_t timeout,
+                                      size_t *const resume)
+{
+    int rc = EXIT_SUCCESS;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && count > i; i++)
+    {
+        if (server_is_control(server, events[i].fd))
+            rc = server_process_control(server, events[i].fd);
+        else if (!server_is_listener(listeners, events[i].fd))
+            rc = server_process_ready(server, request, call, events[i].fd);
+        else
+            rc = server_accept(server, server->multiplexer, listeners,
+                               events[i].fd, server->budget, timeout, resume);
+    }
+
+    return rc;
+}
+
+// Connection, that has started to send request, is answered with 408, while
+// idle one is closed silently, as its client may send the next request at
+// the same moment and take any reply for the answer to it
+static int server_process_timeout(server_t *const server,
+                                  const multiplexer_event_t *const events,
+                                  const size_t count)
+{
+    int rc = EXIT_SUCCESS;
+    char byte = 0;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && count > i; i++)
+    {
+        LOG_F(WARNING, "Socket %d: timeout", events[i].fd);
+
+        if (0 < recv(events[i].fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT))
+            server_timeout_reply(server, events[i].fd);
+
+        if (EXIT_SUCCESS != server_close(server, events[i].fd))
+            rc = ERROR_SERVER_CLOSE;
+    }
+
+    return rc;
+}
+
+// Drain stops accepting and lets connections, that are already taken, finish:
+// waiting ones get short timeout, kept alive ones are closed after response.
+// Control channel is signalled again, until every one of loops has seen it.
+// Returns 1, once nothing but control channel is left in pool.
+static int server_drain(server_t *const server,
+                        multiplexer_t *const multiplexer,
+                        const server_listeners_t *const listeners,
+                        size_t *const resume, int *const drained,
+                        const size_t loops)
+{
+    if (!server_draining(server))
+        return 0;
+
+    size_t seen = 0;
+
+    if (!*drained)
+    {
+        LOG_M(INFO, "Draining");
+
+        // Paused listeners are already out of pool
+        if (0 == *resume)
+            server_listeners_remove(multiplexer, listeners);
+
+        *resume = 0;
+        *drained = 1;
+        multiplexer_shorten(multiplexer, DRAIN_TIMEOUT);
+        seen = __atomic_add_fetch(&server->drained, 1, __ATOMIC_ACQ_REL);
+    }
+    else
+        seen = __atomic_load_n(&server->drained, __ATOMIC_ACQUIRE);
+
+    if (loops > seen)
+        server_control(server, 0);
+
+    return 2 >= multiplexer_size(multiplexer);
+}
+
+// Socket, that is left on path by previous run, is replaced. Anything else
+// on it makes bind fail.
+static void server_unlink_stale(const server_address_t *const endpoint)
+{
+    const struct sockaddr_un *un =
+        (const struct sockaddr_un *)&endpoint->address;
+    struct stat info;
+
+    if (0 == lstat(un->sun_path, &info) && S_ISSOCK(info.st_mode))
+        unlink(un->sun_path);
+}
+
+// CPU, that is meant for shard of the index: the index-th of those, that the
+// process may run on
+static int server_cpu(const size_t index)
+{
+    cpu_set_t set;
+
+    if (EXIT_SUCCESS != sched_getaffinity(0, sizeof(set), &set)
+        || 0 == CPU_COUNT(&set))
+        return index;
+
+    size_t left = index % CPU_COUNT(&set);
+
+    for (int cpu = 0; CPU_SETSIZE > cpu; cpu++)
+        if (CPU_ISSET(cpu, &set) && 0 == left--)
+            return cpu;
+
+    return index;
+}
+
+static void server_pin(const int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (EXIT_SUCCESS != pthread_setaffinity_np(pthread_self(), sizeof(set),
+                                               &set))
+        LOG_F(WARNING, "Unable to pin thread to CPU %d", cpu);
+}
+
+// Option is read back after it is set, as the kernel may round, cap or ignore
+// it. Failure isn't fatal: listener works with the default of system.
+static void server_tune_option(const int fd, const int level, const int name,
+                               const char *const title, const int value)
+{
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+
+    if (-1 == setsockopt(fd, level, name, &value, sizeof(value)))
+        LOG_F(WARNING, "Listener %d: unable to set %s: %s", fd, title,
+              strerror(errno));
+    else if (-1 == getsockopt(fd, level, name, &actual, &len))
+        LOG_F(WARNING, "Listener %d: unable to verify %s: %s", fd, title,
+              strerror(errno));
+    else if (!actual != !value)
+        LOG_F(WARNING, "Listener %d: %s is %d instead of %d", fd, title,
+              actual, value);
+    else
+        LOG_F(INFO, "Listener %d: %s %d", fd, title, actual);
+}
+
+// Defer accept keeps connections, that haven't sent anything yet, in the
+// kernel, so they neither wake the loop nor reach workers
+static void server_tune(const server_tuning_t *const tuning, const int fd,
+                        const int family, const int cpu)
+{
+    if (AF_UNIX == family)
+        return;
+
+    if (tuning->defer_accept)
+        server_tune_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, "defer accept",
+                           tuning->defer_accept);
+
+    if (tuning->fastopen)
+        server_tune_option(fd, IPPROTO_TCP, TCP_FASTOPEN, "fast open",
+                           tuning->fastopen);
+
+    if (tuning->busy_poll)
+        server_tune_option(fd, SOL_SOCKET, SO_BUSY_POLL, "busy poll",
+                           tuning->busy_poll);
+
+    if (-1 != cpu)
+        server_tune_option(fd, SOL_SOCKET, SO_INCOMING_CPU, "incoming CPU",
+                           cpu);
+}
+
+// With reuseport every caller gets its own socket on the same port and the
+// kernel spreads incoming connections between them. CPU of -1 leaves incoming
+// CPU unset.
+static int server_bind(const server_t *const server,
+                       const server_address_t *const endpoint,
+                       int *const listen_fd, const int reuseport,
+                       const int cpu)
+{
+    int rc = EXIT_SUCCESS;
+    int family = endpoint->address.ss_family;
+
+    if (-1 == (*listen_fd = socket(family, SOCK_STREAM, 0)))
+    {
+        LOG_M(ERROR, "Unable to create socket");
+        *listen_fd = 0;
+        rc = EXIT_FAILURE;
+    }
+
+    if (EXIT_SUCCESS == rc)
+    {
+        int flags = fcntl(*listen_fd, F_GETFL, 0);
+        flags |= O_NONBLOCK;
+        fcntl(*listen_fd, F_SETFL, flags);
+    }
+
+    if (EXIT_SUCCESS == rc && AF_UNIX != family)
+    {
+        int on = 1;
+        rc = setsockopt(*listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (EXIT_SUCCESS == rc && reuseport)
+            rc = setsockopt(*listen_fd, SOL_SOCKET, SO_REUSEPORT, &on,
+                            sizeof(on));
+
+        // Dual-stack is set explicitly, as default of system may differ
+        if (EXIT_SUCCESS == rc && AF_INET6 == family)
+            rc = setsockopt(*listen_fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                            &endpoint->v6only, sizeof(endpoint->v6only));
+
+        if (EXIT_SUCCESS != rc)
+            LOG_M(ERROR, "Unable to set socket options");
+    }
+
+    if (EXIT_SUCCESS == rc)
+        server_tune(&server->tuning, *listen_fd, family, cpu);
+
+    if (EXIT_SUCCESS == rc && AF_UNIX == family)
+        server_unlink_stale(endpoint);
+
+    if (EXIT_SUCCESS == rc
+        && (-1 == bind(*listen_fd, (const struct sockaddr *)&endpoint->address,
+                       endpoint->len)))
+    {
+        LOG_F(ERROR, "Unable to bind socket: %s", strerror(errno));
+        rc = EXIT_FAILURE;
+    }
+
+    int backlog = server->tuning.backlog ? server->tuning.backlog
+                                         : SOMAXCONN;
+
+    if (EXIT_SUCCESS == rc && (-1 == listen(*listen_fd, backlog)))
+    {
+        LOG_M(ERROR, "Unable to mark socket as listen");
+        rc = EXIT_FAILURE;
+    }
+    else if (EXIT_SUCCESS == rc)
+        LOG_F(INFO, "Listener %d: backlog %d", *listen_fd, backlog);
+
+    if (EXIT_SUCCESS != rc && 0 != *listen_fd)
+    {
+        close(*listen_fd);
+        *listen_fd = 0;
+    }
+
+    return rc;
+}
+
+// Every endpoint of server gets a listener. Unix socket can't be bound twice
+// with reuseport, so the one of shared set is duplicated instead.
+static int server_listen(const server_t *const server,
+                         server_listeners_t *const listeners,
+                         const int reuseport,
+                         const server_listeners_t *const shared,
+                         const int cpu)
+{
+    int rc = EXIT_SUCCESS;
+
+    listeners->size = 0;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && server->endpoints_size > i; i++)
+    {
+        const server_address_t *endpoint = server->endpoints + i;
+        int fd = 0;
+
+        if (NULL != shared && AF_UNIX == endpoint->address.ss_family)
+        {
+            if (-1 == (fd = fcntl(shared->fds[i], F_DUPFD_CLOEXEC, 0)))
+            {
+                LOG_M(ERROR, "Unable to duplicate socket");
+                rc = EXIT_FAILURE;
+            }
+        }
+        else
+            rc = server_bind(server, endpoint, &fd, reuseport, cpu);
+
+        if (EXIT_SUCCESS == rc)
+            listeners->fds[listeners->size++] = fd;
+    }
+
+    if (EXIT_SUCCESS != rc)
+        server_listeners_close(listeners);
+
+    return rc;
+}
+
+static int server_reactor_loop(server_t *const server,
+                               const server_listeners_t *const listeners)
+{
+    int rc = EXIT_SUCCESS;
+    multiplexer_event_t events[SERVER_EVENTS];
+    size_t count = 0;
+    size_t timeout = server->timeout, applied = server->timeout;
+    size_t resume = 0;
+    int drained = 0;
+    // Requests for immediate handlers are answered by the loop itself
+    request_t *request = request_blank(REQUEST_SIZE);
+    handler_call_t *call = handler_call_init();
+
+    if (NULL == request || NULL == call
+        || EXIT_SUCCESS != request_set_limits(request, &server->requests))
+        rc = ERROR_SERVER_ALLOCATION;
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_listeners_add(server->multiplexer, listeners);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_control_register(server, server->multiplexer);
+
+    if (EXIT_SUCCESS == rc)
+        LOG_M(INFO, "Server up");
+
+    // Wait is limited only by the closest connection timeout and paused
+    // accept, everything else arrives through control channel
+    while (EXIT_SUCCESS == rc && server_running(server)
+           && !server_drain(server, server->multiplexer, listeners, &resume,
+                            &drained, 1))
+    {
+        size_t wait = server_resume_accept(server->multiplexer, listeners,
+                                           &resume);
+
+        rc = multiplexer_wait(server->multiplexer, events, SERVER_EVENTS,
+                              &count, wait);
+
+        // Process ready
+        if (EXIT_SUCCESS == rc)
+            rc = server_process_connections(server, listeners, request, call,
+                                            events, count, timeout, &resume);
+
+        timeout = server_adapt_timeout(server, server->multiplexer, 1,
+                                       &applied);
+
+        // Remove timeout
+        if (EXIT_SUCCESS == rc)
+            rc = multiplexer_timeout(server->multiplexer, events,
+                                     SERVER_EVENTS, &count);
+
+        if (EXIT_SUCCESS == rc)
+            rc = server_process_timeout(server, events, count);
+    }
+
+    server_control_unregister(server, server->multiplexer);
+    server_listeners_remove(server->multiplexer, listeners);
+    multiplexer_clear(server->multiplexer);
+    request_free(&request);
+    handler_call_free(&call);
+
+    return rc;
+}
+
+// Answers requests on the calling thread. Connection, that stays open, goes
+// back to the pool to wait for the next one.
+static int server_serve(server_t *const server,
+                        multiplexer_t *const multiplexer,
+                        const size_t timeout, request_t *const request,
+                        handler_call_t *const call, const int socket)
+{
+    worker_task_t task = {socket, NULL, 0, 0, NULL, server->limiter};
+    int rc = EXIT_SUCCESS, error = 0, keep = 0;
+
+    if (server_limit_request(server, socket))
+        return EXIT_SUCCESS == server_close(server, socket)
+               ? EXIT_SUCCESS : ERROR_SERVER_CLOSE;
+
+    server_count(&server->counters.served);
+
+    if (EXIT_SUCCESS != worker_serve(server_handlers(server, socket), request,
+                                     call, &task, &keep, &error))
+        worker_error_func(server, socket, error);
+
+    if (keep && !server_draining(server)
+        && EXIT_SUCCESS == multiplexer_add(multiplexer, socket, READ,
+                                           timeout))
+        LOG_F(INFO, "Socket %d: kept alive", socket);
+    else if (EXIT_SUCCESS != server_close(server, socket))
+        rc = ERROR_SERVER_CLOSE;
+
+    return rc;
+}
+
+typedef struct
+{
+    server_t *server;
+    multiplexer_t *multiplexer;
+    server_listeners_t listeners;
+    size_t index;
+    int cpu;
+    pthread_t thread;
+    int rc;
+} server_shard_t;
+
+static int server_shard_serve(server_shard_t *const shard,
+                              const size_t timeout, request_t *const request,
+                              handler_call_t *const call, const int socket)
+{
+    LOG_F(INFO, "Socket %d: ready", socket);
+
+    int rc = multiplexer_remove(shard->multiplexer, socket);
+
+    if (EXIT_SUCCESS != rc)
+        LOG_F(ERROR, "Socket %d: unable to remove socket from pool", socket);
+
+    int src = server_serve(shard->server, shard->multiplexer, timeout,
+                           request, call, socket);
+
+    return EXIT_SUCCESS != rc ? rc : src;
+}
+
+static int server_shard_loop(server_shard_t *const shard)
+{
+    int rc = EXIT_SUCCESS;
+    server_listeners_t *listeners = &shard->listeners;
+    int drained = 0;
+    multiplexer_event_t events[SERVER_EVENTS];
+    size_t count = 0;
+    size_t timeout = shard->server->timeout;
+    size_t applied = shard->server->timeout;
+    size_t resume = 0;
+    request_t *request = request_blank(REQUEST_SIZE);
+    handler_call_t *call = handler_call_init();
+
+    if (NULL == request || NULL == call
+        || EXIT_SUCCESS != request_set_limits(request,
+                                              &shard->server->requests))
+        rc = ERROR_SERVER_ALLOCATION;
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_listeners_add(shard->multiplexer, listeners);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_control_register(shard->server, shard->multiplexer);
+
+    if (EXIT_SUCCESS == rc && shard->server->affinity)
+        server_pin(shard->cpu);
+
+    if (EXIT_SUCCESS == rc)
+        LOG_F(INFO, "Shard %zu up", shard->index);
+
+    while (EXIT_SUCCESS == rc && server_running(shard->server))
+    {
+        // Listeners of shard aren't passed on, so connections, that are
+        // queued in them, are taken before they are closed
+        for (size_t i = 0; !drained && server_draining(shard->server)
+                           && EXIT_SUCCESS == rc && listeners->size > i; i++)
+            rc = server_accept(shard->server, shard->multiplexer, listeners,
+                               listeners->fds[i], SIZE_MAX, timeout, &resume);
+
+        if (EXIT_SUCCESS == rc
+            && server_drain(shard->server, shard->multiplexer, listeners,
+                            &resume, &drained, shard->server->max_threads))
+            break;
+
+        if (drained)
+            server_listeners_close(listeners);
+
+        size_t wait = server_resume_accept(shard->multiplexer, listeners,
+                                           &resume);
+
+        rc = multiplexer_wait(shard->multiplexer, events, SERVER_EVENTS,
+                              &count, wait);
+
+        // Accept and serve on this thread
+        for (size_t i = 0; EXIT_SUCCESS == rc && count > i; i++)
+        {
+            if (server_is_control(shard->server, events[i].fd))
+                rc = server_process_control(shard->server, events[i].fd);
+            else if (!server_is_listener(listeners, events[i].fd))
+                rc = server_shard_serve(shard, timeout, request, call,
+                                        events[i].fd);
+            else
+                rc = server_accept(shard->server, shard->multiplexer,
+                                   listeners, events[i].fd,
+                                   shard->server->budget, timeout, &resume);
+        }
+
+        // Every shard gets equal part of capacity
+        timeout = server_adapt_timeout(shard->server, shard->multiplexer,
+                                       shard->server->max_threads, &applied);
+
+        // Remove timeout
+        if (EXIT_SUCCESS == rc)
+            rc = multiplexer_timeout(shard->multiplexer, events,
+                                     SERVER_EVENTS, &count);
+
+        if (EXIT_SUCCESS == rc)
+            rc = server_process_timeout(shard->server, events, count);
+    }
+
+    server_listeners_remove(shard->multiplexer, listeners);
+    server_listeners_close(listeners);
+    server_control_unregister(shard->server, shard->multiplexer);
+    multiplexer_clear(shard->multiplexer);
+    request_free(&request);
+    handler_call_free(&call);
+
+    LOG_F(INFO, "Shard %zu down", shard->index);
+
+    return rc;
+}
+
+static void *server_shard_main(void *arg)
+{
+    server_shard_t *shard = arg;
+
+    shard->rc = server_shard_loop(shard);
+
+    return NULL;
+}
+
+// Every thread owns listening sockets, multiplexer and timeouts, so nothing
+// is shared between shards except handlers and unix sockets. Shard 0 runs on
+// the calling thread and uses multiplexer of server.
+static int server_sharded_loop(server_t *const server)
+{
+    int rc = EXIT_SUCCESS;
+    size_t started = 1;
+    server_shard_t *shards = calloc(server->max_threads,
+                                    sizeof(server_shard_t));
+
+    if (NULL == shards)
+        return ERROR_SERVER_ALLOCATION;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && server->max_threads > i; i++)
+    {
+        shards[i].server = server;
+        shards[i].index = i;
+        shards[i].rc = EXIT_SUCCESS;
+        // Taken before any shard is pinned, as threads inherit affinity
+        shards[i].cpu = server_cpu(i);
+        shards[i].multiplexer = i ? multiplexer_init(server->multiplexer_type)
+                                  : server->multiplexer;
+
+        if (NULL == shards[i].multiplexer)
+            rc = ERROR_SERVER_MULTIPLEXING;
+
+        if (EXIT_SUCCESS == rc)
+            rc = server_listen(server, &shards[i].listeners, 1,
+                               i ? &shards[0].listeners : NULL,
+                               server->tuning.incoming_cpu || server->affinity
+                               ? shards[i].cpu : -1);
+    }
+
+    // Previous instance is told to drain only once every shard listens
+    // beside it
+    server_listeners_t taken = {{0}, 0};
+
+    if (EXIT_SUCCESS == rc && server->upgrade)
+        rc = server_takeover(server, &taken);
+
+    server_listeners_close(&taken);
+
+    if (EXIT_SUCCESS == rc && server->upgrade)
+        rc = server_handoff_start(server, &taken);
+
+    for (; EXIT_SUCCESS == rc && server->max_threads > started; started++)
+        if (EXIT_SUCCESS != pthread_create(&shards[started].thread, NULL,
+                                           server_shard_main,
+                                           shards + started))
+        {
+            LOG_F(ERROR, "Unable to start shard %zu", started);
+            rc = ERROR_SERVER_ALLOCATION;
+        }
+
+    if (EXIT_SUCCESS == rc)
+        LOG_M(INFO, "Server up");
+
+    // Shards, that have been already started, are stopped like on signal.
+    // Listeners of shard 0 are closed by its loop, unless it isn't run.
+    if (EXIT_SUCCESS == rc)
+        rc = server_shard_loop(shards);
+    else
+    {
+        server_control(server, SERVER_CONTROL_STOP);
+        server_listeners_close(&shards[0].listeners);
+    }
+
+    for (size_t i = 1; started > i; i++)
+    {
+        pthread_join(shards[i].thread, NULL);
+
+        if (EXIT_SUCCESS != shards[i].rc)
+            LOG_F(ERROR, "Shard %zu failed", i);
+
+        if (EXIT_SUCCESS == rc)
+            rc = shards[i].rc;
+    }
+
+    // Listeners of shards, that haven't been started, are left
+    for (size_t i = started; server->max_threads > i; i++)
+        server_listeners_close(&shards[i].listeners);
+
+    for (size_t i = 1; server->max_threads > i; i++)
+        multiplexer_free(&shards[i].multiplexer);
+
+    free(shards);
+
+    return rc;
+}
+
+typedef struct
+{
+    server_t *server;
+    const server_listeners_t *listeners;
+    pthread_mutex_t leader;
+    size_t timeout;
+    size_t applied;
+    size_t resume;
+    int drained;
+    int rc;
+} server_followers_t;
+
+// Leader waits until it gets a connection, accepting and expiring meanwhile,
+// then hands leadership to the next follower and serves connection itself
+static int server_follower_loop(server_followers_t *const followers)
+{
+    int rc = EXIT_SUCCESS;
+    multiplexer_event_t events[SERVER_EVENTS];
+    size_t count = 0;
+    server_t *server = followers->server;
+    request_t *request = request_blank(REQUEST_SIZE);
+    handler_call_t *call = handler_call_init();
+
+    if (NULL == request || NULL == call
+        || EXIT_SUCCESS != request_set_limits(request, &server->requests))
+        rc = ERROR_SERVER_ALLOCATION;
+
+    while (EXIT_SUCCESS == rc && server_running(server))
+    {
+        int socket = -1, locked = 0;
+        size_t timeout = 0;
+
+        if (EXIT_SUCCESS != pthread_mutex_lock(&followers->leader))
+            rc = ERROR_SERVER_LOCK;
+        else
+            locked = 1;
+
+        while (EXIT_SUCCESS == rc && server_running(server) && -1 == socket)
+        {
+            size_t wait = server_resume_accept(server->multiplexer,
+                                               followers->listeners,
+                                               &followers->resume);
+
+            rc = multiplexer_wait(server->multiplexer, events, SERVER_EVENTS,
+                                  &count, wait);
+
+            // The rest of ready connections stay in pool and are reported to
+            // the next leader
+            for (size_t i = 0; EXIT_SUCCESS == rc && count > i; i++)
+            {
+                if (server_is_control(server, events[i].fd))
+                    rc = server_process_control(server, events[i].fd);
+                else if (server_is_listener(followers->listeners,
+                                            events[i].fd))
+                    rc = server_accept(server, server->multiplexer,
+                                       followers->listeners, events[i].fd,
+                                       server->budget, followers->timeout,
+                                       &followers->resume);
+                else if (-1 == socket)
+                    socket = events[i].fd;
+            }
+
+            followers->timeout = server_adapt_timeout(server,
+                                                      server->multiplexer, 1,
+                                                      &followers->applied);
+
+            if (EXIT_SUCCESS == rc)
+                rc = multiplexer_timeout(server->multiplexer, events,
+                                         SERVER_EVENTS, &count);
+
+            if (EXIT_SUCCESS == rc)
+                rc = server_process_timeout(server, events, count);
+
+            // Pool is shared, so the last one to empty it stops the rest
+            if (EXIT_SUCCESS == rc && -1 == socket
+                && server_drain(server, server->multiplexer,
+                                followers->listeners, &followers->resume,
+                                &followers->drained, 1))
+                server_control(server, SERVER_CONTROL_STOP);
+        }
+
+        if (-1 != socket)
+        {
+            LOG_F(INFO, "Socket %d: ready", socket);
+
+            if (EXIT_SUCCESS != multiplexer_remove(server->multiplexer, socket))
+                LOG_F(ERROR, "Socket %d: unable to remove socket from pool",
+                      socket);
+        }
+
+        // Timeout is owned by leader, so it is taken before leaving.
+        // Leadership is given up on failure as well, otherwise the rest
+        // would wait for it, where stop doesn't reach them.
+        timeout = followers->timeout;
+
+        if (locked && EXIT_SUCCESS != pthread_mutex_unlock(&followers->leader)
+            && EXIT_SUCCESS == rc)
+            rc = ERROR_SERVER_LOCK;
+
+        if (-1 != socket)
+        {
+            int src = server_serve(server, server->multiplexer, timeout,
+                                   request, call, socket);
+
+            rc = EXIT_SUCCESS != rc ? rc : src;
+
+            // Leader may wait on the emptied pool without any timeout left
+            if (server_draining(server))
+                server_control(server, 0);
+        }
+    }
+
+    // Failure of any thread stops the rest
+    if (EXIT_SUCCESS != rc)
+    {
+        followers->rc = rc;
+        server_control(server, SERVER_CONTROL_STOP);
+    }
+
+    request_free(&request);
+    handler_call_free(&call);
+
+    return rc;
+}
+
+static void *server_follower_main(void *arg)
+{
+    server_follower_loop(arg);
+
+    return NULL;
+}
+
+// Threads take turns waiting on the shared multiplexer, so a connection is
+// served by the thread, that has seen it ready, without passing it through
+// a pipe. The calling thread is one of followers.
+static int server_followers_loop(server_t *const server,
+                                 const server_listeners_t *const listeners)
+{
+    server_followers_t followers = {server, listeners,
+                                    PTHREAD_MUTEX_INITIALIZER, server->timeout,
+                                    server->timeout, 0, 0, EXIT_SUCCESS};
+    pthread_t *threads = malloc(server->max_threads * sizeof(pthread_t));
+    size_t started = 1;
+    int rc = EXIT_SUCCESS;
+
+    if (NULL == threads)
+        rc = ERROR_SERVER_ALLOCATION;
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_listeners_add(server->multiplexer, listeners);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_control_register(server, server->multiplexer);
+
+    for (; EXIT_SUCCESS == rc && server->max_threads > started; started++)
+        if (EXIT_SUCCESS != pthread_create(threads + started, NULL,
+                                           server_follower_main, &followers))
+        {
+            LOG_F(ERROR, "Unable to start follower %zu", started);
+            rc = ERROR_SERVER_ALLOCATION;
+        }
+
+    if (EXIT_SUCCESS == rc)
+    {
+        LOG_M(INFO, "Server up");
+        server_follower_loop(&followers);
+        rc = followers.rc;
+    }
+    else
+        server_control(server, SERVER_CONTROL_STOP);
+
+    for (size_t i = 1; started > i; i++)
+        pthread_join(threads[i], NULL);
+
+    if (EXIT_SUCCESS == rc)
+        rc = followers.rc;
+
+    server_control_unregister(server, server->multiplexer);
+    server_listeners_remove(server->multiplexer, listeners);
+    multiplexer_clear(server->multiplexer);
+    pthread_mutex_destroy(&followers.leader);
+    free(threads);
+
+    return rc;
+}
+
+enum
+{
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_CANCEL,
+    URING_OP_CONTROL,
+    URING_OP_RETURN
+};
+
+enum
+{
+    URING_CONNECTION_FREE = 0,
+    URING_CONNECTION_RECV,
+    URING_CONNECTION_CANCEL
+};
+
+// Timer comes first, so that connection is found by its entry
+typedef struct
+{
+    timer_wheel_entry_t timer;
+    int state;
+    int complete;
+    int expired;
+    int late;
+    unsigned generation;
+    size_t started;
+    char *data;
+    size_t size;
+    size_t capacity;
+} uring_connection_t;
+
+typedef struct
+{
+    server_t *server;
+    uring_t *ring;
+    const server_listeners_t *listeners;
+    uring_connection_t *connections;
+    size_t size;
+    size_t active;
+    size_t resume;
+    int drained;
+    request_t *request;
+    handler_call_t *call;
+    timer_wheel_t *timers;
+    size_t applied;
+} uring_loop_t;
+
+static uint64_t uring_data(const int op, const unsigned generation,
+                           const int fd)
+{
+    return (uint64_t)op << 56 | (uint64_t)(generation & 0xFFFFFF) << 32
+           | (uint32_t)fd;
+}
+
+static int uring_arm_accept(uring_loop_t *const loop, const int listen_fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    if (NULL == sqe)
+        return ERROR_SERVER_URING;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = uring_data(URING_OP_ACCEPT, 0, listen_fd);
+
+    return EXIT_SUCCESS;
+}
+
+static int uring_cancel_accept(uring_loop_t *const loop, const int listen_fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    if (NULL == sqe)
+        return ERROR_SERVER_URING;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_data(URING_OP_ACCEPT, 0, listen_fd);
+    sqe->user_data = uring_data(URING_OP_CANCEL, 0, listen_fd);
+
+    return EXIT_SUCCESS;
+}
+
+// Every listener has its own multishot accept. Cancel of the one, that has
+// already ended, simply fails.
+static int uring_accept_all(uring_loop_t *const loop, const int arm)
+{
+    int rc = EXIT_SUCCESS;
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && loop->listeners->size > i; i++)
+        rc = arm ? uring_arm_accept(loop, loop->listeners->fds[i])
+                 : uring_cancel_accept(loop, loop->listeners->fds[i]);
+
+    return rc;
+}
+
+static int uring_arm_poll(uring_loop_t *const loop, const int fd,
+                          const int op)
+{
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    if (NULL == sqe)
+        return ERROR_SERVER_URING;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = uring_data(op, 0, fd);
+
+    return EXIT_SUCCESS;
+}
+
+static int uring_arm_recv(uring_loop_t *const loop, const int fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    if (NULL == sqe)
+        return ERROR_SERVER_URING;
+
+    uring_connection_t *connection = loop->connections + fd;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = uring_data(URING_OP_RECV, connection->generation, fd);
+    connection->state = URING_CONNECTION_RECV;
+
+    return EXIT_SUCCESS;
+}
+
+static int uring_cancel_recv(uring_loop_t *const loop, const int fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    if (NULL == sqe)
+        return ERROR_SERVER_URING;
+
+    uring_connection_t *connection = loop->connections + fd;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_data(URING_OP_RECV, connection->generation, fd);
+    sqe->user_data = uring_data(URING_OP_CANCEL, connection->generation, fd);
+    connection->state = URING_CONNECTION_CANCEL;
+
+    return EXIT_SUCCESS;
+}
+
+static void uring_release(uring_loop_t *const loop, const int fd)
+{
+    uring_connection_t *connection = loop->connections + fd;
+
+    timer_wheel_cancel(loop->timers, &connection->timer);
+    free(connection->data);
+    connection->data = NULL;
+    connection->size = 0;
+    connection->capacity = 0;
+    connection->state = URING_CONNECTION_FREE;
+    loop->active--;
+
+    if (EXIT_SUCCESS != server_close(loop->server, fd))
+        LOG_F(ERROR, "Socket %d: unable to close", fd);
+}
+
+// Timeout for new connections follows occupancy of the loop
+static size_t uring_timeout(uring_loop_t *const loop)
+{
+    size_t timeout = server_timeout_at(loop->server, loop->active, 1);
+
+    if (loop->drained && (0 == timeout || DRAIN_TIMEOUT < timeout))
+        timeout = DRAIN_TIMEOUT;
+
+    return timeout;
+}
+
+static void uring_connection_arm(uring_loop_t *const loop,
+                                 uring_connection_t *const connection,
+                                 const size_t timeout)
+{
+    timer_wheel_cancel(loop->timers, &connection->timer);
+
+    if (timeout)
+        timer_wheel_arm(loop->timers, &connection->timer, timeout);
+}
+
+// Timers are linked by address, so every armed one is moved to the new array
+// with the same expiry
+static int uring_connections_grow(uring_loop_t *const loop, const size_t size)
+{
+    uring_connection_t *tmp = calloc(size, sizeof(uring_connection_t));
+
+    if (NULL == tmp)
+        return ERROR_SERVER_ALLOCATION;
+
+    size_t now = timer_wheel_clock();
+
+    for (size_t i = 0; loop->size > i; i++)
+    {
+        uring_connection_t *connection = loop->connections + i;
+
+        tmp[i] = *connection;
+        timer_wheel_entry_init(&tmp[i].timer);
+
+        if (connection->timer.armed)
+        {
+            size_t expire = connection->timer.expire;
+
+            timer_wheel_cancel(loop->timers, &connection->timer);
+            timer_wheel_arm(loop->timers, &tmp[i].timer,
+                            expire > now ? expire - now : 0);
+        }
+    }
+
+    free(loop->connections);
+    loop->connections = tmp;
+    loop->size = size;
+
+    return EXIT_SUCCESS;
+}
+
+static int uring_connection_new(uring_loop_t *const loop, const int fd)
+{
+    if ((size_t)fd >= loop->size)
+    {
+        size_t size = loop->size ? loop->size : URING_CONNECTIONS;
+
+        for (; (size_t)fd >= size; size *= 2);
+
+        if (EXIT_SUCCESS != uring_connections_grow(loop, size))
+            return ERROR_SERVER_ALLOCATION;
+    }
+
+    uring_connection_t *connection = loop->connections + fd;
+
+    loop->active++;
+    connection->generation++;
+    connection->complete = 0;
+    connection->expired = 0;
+    connection->late = 0;
+    connection->size = 0;
+    connection->started = 0;
+    uring_connection_arm(loop, connection, uring_timeout(loop));
+
+    return uring_arm_recv(loop, fd);
+}
+
+// Deadline of request runs from its first byte and replaces connection
+// timeout, when it comes earlier
+static void uring_started(uring_loop_t *const loop,
+                          uring_connection_t *const connection)
+{
+    size_t deadline = loop->server->requests.timeout;
+
+    connection->started = timer_wheel_clock();
+
+    if (deadline && (!connection->timer.armed
+                     || connection->started + deadline
+                        < connection->timer.expire))
+        uring_connection_arm(loop, connection, deadline);
+}
+
+// Request is complete for dispatch, once header ends or it is over limits,
+// so that worker refuses it
+static int uring_append(uring_connection_t *const connection,
+                        const request_limits_t *const limits,
+                        const char *const data, const size_t size)
+{
+    if (connection->size + size > connection->capacity)
+    {
+        size_t capacity = connection->capacity ? connection->capacity
+                                               : URING_BUFFER_SIZE;
+
+        for (; connection->size + size > capacity; capacity *= 2);
+
+        char *tmp = realloc(connection->data, capacity);
+
+        if (NULL == tmp)
+            return ERROR_SERVER_ALLOCATION;
+
+        connection->data = tmp;
+        connection->capacity = capacity;
+    }
+
+    // Terminating empty line may be split between two reads
+    size_t from = connection->size > 3 ? connection->size - 3 : 0;
+
+    memcpy(connection->data + connection->size, data, size);
+    connection->size += size;
+
+    for (size_t i = from; !connection->complete && connection->size >= i + 4;
+         i++)
+        if (!memcmp(connection->data + i, "\r\n\r\n", 4))
+            connection->complete = 1;
+
+    if ((limits->header ? limits->header : URING_HEADER_LIMIT)
+        <= connection->size)
+        connection->complete = 1;
+
+    if (limits->line && limits->line <= connection->size
+        && NULL == memchr(connection->data, '\n', limits->line))
+        connection->complete = 1;
+
+    return EXIT_SUCCESS;
+}
+
+// Connection answered by the loop waits for the next request at once, its
+// buffer is kept for it, unless it has grown over initial size
+static int uring_answered(uring_loop_t *const loop, const int fd,
+                          const int keep)
+{
+    uring_connection_t *connection = loop->connections + fd;
+    int rc = EXIT_SUCCESS;
+
+    LOG_F(INFO, "Socket %d: answered by loop", fd);
+
+    if (URING_BUFFER_SIZE < connection->capacity)
+    {
+        free(connection->data);
+        connection->data = NULL;
+        connection->capacity = 0;
+    }
+
+    if (keep && server_running(loop->server)
+        && !server_draining(loop->server))
+    {
+        loop->connections[fd].state = URING_CONNECTION_FREE;
+        loop->active--;
+        rc = uring_connection_new(loop, fd);
+
+        if (EXIT_SUCCESS != rc)
+            LOG_F(ERROR, "Socket %d: Unable to add to pool. Internal error",
+                  fd);
+    }
+
+    if (!keep || EXIT_SUCCESS != rc || !server_running(loop->server)
+        || server_draining(loop->server))
+        uring_release(loop, fd);
+
+    return EXIT_SUCCESS;
+}
+
+static int uring_dispatch(uring_loop_t *const loop, const int fd)
+{
+    uring_connection_t *connection = loop->connections + fd;
+    server_t *server = loop->server;
+    worker_task_t task = {fd, connection->data, connection->size, 0,
+                          server_handlers(server, fd), server->limiter};
+    int rc = EXIT_SUCCESS, keep = 0;
+
+    // Request is already read, so nothing is left to discard
+    if (server_limit_request(server, fd))
+    {
+        uring_release(loop, fd);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (server_answer_inline(server, task.handlers, loop->request, loop->call,
+                             fd, connection->data, connection->size, &keep))
+        return uring_answered(loop, fd, keep);
+
+    timer_wheel_cancel(loop->timers, &connection->timer);
+    connection->data = NULL;
+    connection->size = 0;
+    connection->capacity = 0;
+    connection->state = URING_CONNECTION_FREE;
+    loop->active--;
+
+    LOG_F(INFO, "Socket %d: ready", fd);
+    int drc = worker_request_dispatch_cpu(server->workers,
+                                          server->max_threads, &task,
+                                          server_incoming_cpu(server, fd));
+
+    if (EXIT_SUCCESS != drc)
+    {
+        LOG_F(WARNING, "Socket %d: connection refused", fd);
+        server_count(&server->counters.refused);
+        free(task.data);
+        rc = server_refuse_connection(fd);
+
+        if (EXIT_SUCCESS != server_close(server, fd))
+            rc = rc ? rc : ERROR_SERVER_CLOSE;
+
+        if (EXIT_SUCCESS != rc)
+            LOG_F(ERROR, "Socket %d: unable to refuse", fd);
+    }
+    else
+    {
+        server_count(&server->counters.dispatched);
+        LOG_F(INFO, "Socket %d: dispatched", fd);
+    }
+
+    return rc;
+}
+
+static int uring_process_recv(uring_loop_t *const loop,
+                              const struct io_uring_cqe *const cqe)
+{
+    int fd = (int)(cqe->user_data & 0xFFFFFFFF);
+    unsigned generation = (cqe->user_data >> 32) & 0xFFFFFF;
+    uring_connection_t *connection = NULL;
+    int rc = EXIT_SUCCESS;
+
+    if ((size_t)fd < loop->size)
+        connection = loop->connections + fd;
+
+    if (NULL != connection
+        && (URING_CONNECTION_FREE == connection->state
+            || (connection->generation & 0xFFFFFF) != generation))
+        connection = NULL;
+
+    if (IORING_CQE_F_BUFFER & cqe->flags)
+    {
+        unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (NULL != connection && 0 < cqe->res)
+        {
+            int first = 0 == connection->size;
+
+            rc = uring_append(connection, &loop->server->requests,
+                              uring_buffer(loop->ring, id), cqe->res);
+
+            if (EXIT_SUCCESS == rc && first)
+                uring_started(loop, connection);
+        }
+
+        uring_buffer_recycle(loop->ring, id);
+    }
+
+    if (NULL == connection)
+        return EXIT_SUCCESS;
+
+    if (EXIT_SUCCESS != rc)
+    {
+        LOG_F(ERROR, "Socket %d: unable to store request", fd);
+        connection->expired = 1;
+    }
+
+    if (URING_CONNECTION_RECV == connection->state
+        && (connection->complete || connection->expired)
+        && (IORING_CQE_F_MORE & cqe->flags))
+        rc = uring_cancel_recv(loop, fd);
+    else
+        rc = EXIT_SUCCESS;
+
+    if (IORING_CQE_F_MORE & cqe->flags)
+        return rc;
+
+    // Multishot receive is over, no more data will be consumed from socket
+    if (0 == cqe->res
+        || (0 > cqe->res && -ECANCELED != cqe->res && -ENOBUFS != cqe->res))
+    {
+        LOG_F(INFO, "Socket %d: closed before request", fd);
+        uring_release(loop, fd);
+    }
+    else if (connection->expired && connection->late)
+    {
+        LOG_F(WARNING, "Socket %d: request isn't received in time", fd);
+        server_timeout_reply(loop->server, fd);
+        uring_release(loop, fd);
+    }
+    // Idle connection is closed silently, like by reactor
+    else if (connection->expired)
+    {
+        LOG_F(WARNING, "Socket %d: timeout", fd);
+
+        if (connection->size)
+            server_timeout_reply(loop->server, fd);
+
+        uring_release(loop, fd);
+    }
+    else if (connection->complete)
+        rc = uring_dispatch(loop, fd);
+    else
+        rc = uring_arm_recv(loop, fd);
+
+    return rc;
+}
+
+static int uring_pause_accept(uring_loop_t *const loop)
+{
+    LOG_F(WARNING, "Accept paused for %d ms", ACCEPT_BACKOFF);
+    loop->resume = timer_wheel_clock() + ACCEPT_BACKOFF;
+
+    // Accepts of other listeners would go on failing meanwhile
+    return uring_accept_all(loop, 0);
+}
+
+// Multishot accept ends on error. Lack of descriptors or memory rearms it
+// only after a pause, anything else at once.
+static int uring_process_accept(uring_loop_t *const loop,
+                                const struct io_uring_cqe *const cqe)
+{
+    int rc = EXIT_SUCCESS, listen_fd = (int)(uint32_t)cqe->user_data;
+
+    if (0 <= cqe->res)
+        server_count(&loop->server->counters.accepted);
+
+    // Multishot accept doesn't report address of peer
+    if (0 <= cqe->res
+        && server_limit_connection(loop->server, cqe->res, NULL, 0))
+        rc = EXIT_SUCCESS == close(cqe->res) ? EXIT_SUCCESS
+                                             : ERROR_SERVER_CLOSE;
+    else if (0 <= cqe->res)
+    {
+        LOG_F(INFO, "New connection: %d", cqe->res);
+        server_route(loop->server, loop->listeners, listen_fd, cqe->res);
+        rc = uring_connection_new(loop, cqe->res);
+
+        if (EXIT_SUCCESS != rc)
+        {
+            LOG_F(ERROR, "Socket %d: Unable to add to pool. Internal error",
+                  cqe->res);
+
+            if (EXIT_SUCCESS != server_close(loop->server, cqe->res))
+                rc = ERROR_SERVER_CLOSE;
+            else
+                rc = EXIT_SUCCESS;
+        }
+    }
+    else if (-EMFILE == cqe->res || -ENFILE == cqe->res)
+    {
+        LOG_M(ERROR, "Unable to accept connection: out of descriptors");
+        server_shed_connection(listen_fd);
+        rc = uring_pause_accept(loop);
+    }
+    else if (-ENOBUFS == cqe->res || -ENOMEM == cqe->res)
+    {
+        LOG_M(ERROR, "Unable to accept connection: out of memory");
+        rc = uring_pause_accept(loop);
+    }
+    else if (-EAGAIN != cqe->res && -EINTR != cqe->res
+             && -ECONNABORTED != cqe->res && -ECANCELED != cqe->res)
+        LOG_F(WARNING, "Unable to accept connection: %s",
+              strerror(-cqe->res));
+
+    if (EXIT_SUCCESS == rc && 0 == loop->resume && !loop->drained
+        && !(IORING_CQE_F_MORE & cqe->flags))
+        rc = uring_arm_accept(loop, listen_fd);
+
+    return rc;
+}
+
+// Returns time left until accept is rearmed, 0 if it isn't paused
+static size_t uring_resume_accept(uring_loop_t *const loop, int *const rc)
+{
+    if (0 == loop->resume)
+        return 0;
+
+    size_t now = timer_wheel_clock();
+
+    if (now < loop->resume)
+        return loop->resume - now;
+
+    LOG_M(INFO, "Accept resumed");
+    loop->resume = 0;
+    *rc = uring_accept_all(loop, 1);
+
+    return 0;
+}
+
+// Connection is cut by its timer. Request, that has been started, is late,
+// once its deadline has passed.
+static int uring_expire(void *arg, timer_wheel_entry_t *entry)
+{
+    uring_loop_t *loop = arg;
+    uring_connection_t *connection = (uring_connection_t *)entry;
+    size_t deadline = loop->server->requests.timeout;
+
+    // Receive is already being cancelled, connection goes on by its result
+    if (URING_CONNECTION_RECV != connection->state)
+        return EXIT_SUCCESS;
+
+    connection->late = deadline && connection->size
+                       && timer_wheel_clock() >= connection->started + deadline;
+    connection->expired = 1;
+
+    return uring_cancel_recv(loop, connection - loop->connections);
+}
+
+// Connections, that are already waiting, are cut only on notable drop of
+// timeout, as it takes a walk over all of them
+static int uring_process_timeout(uring_loop_t *const loop)
+{
+    size_t timeout = uring_timeout(loop);
+
+    __atomic_store_n(&loop->server->effective, timeout, __ATOMIC_RELAXED);
+
+    if (timeout && (0 == loop->applied
+                    || timeout + timeout / 4 < loop->applied))
+    {
+        size_t limit = timer_wheel_clock() + timeout;
+
+        LOG_F(WARNING, "Connection timeout is cut to %zu ms", timeout);
+
+        for (size_t fd = 0; loop->size > fd; fd++)
+        {
+            uring_connection_t *connection = loop->connections + fd;
+
+            if (URING_CONNECTION_RECV == connection->state
+                && (!connection->timer.armed
+                    || limit < connection->timer.expire))
+                uring_connection_arm(loop, connection, timeout);
+        }
+
+        loop->applied = timeout;
+    }
+    else if (0 == timeout || timeout > loop->applied)
+        loop->applied = timeout;
+
+    timer_wheel_handler_t expire = {uring_expire, loop};
+
+    return timer_wheel_expire(loop->timers, &expire);
+}
+
+static int uring_process_control(uring_loop_t *const loop,
+                                 const struct io_uring_cqe *const cqe)
+{
+    int fd = (int)(cqe->user_data & 0xFFFFFFFF);
+    int rc = server_process_control(loop->server, fd);
+
+    // Poll is oneshot and is armed again after descriptor is drained
+    if (EXIT_SUCCESS == rc && server_running(loop->server))
+        rc = uring_arm_poll(loop, fd, URING_OP_CONTROL);
+
+    return rc;
+}
+
+// Connections kept alive by workers wait for the next request like new ones
+static int uring_process_return(uring_loop_t *const loop)
+{
+    int rc = EXIT_SUCCESS, fd = -1;
+
+    while (EXIT_SUCCESS == rc
+           && sizeof(fd) == read(loop->server->returned[0], &fd, sizeof(fd)))
+    {
+        LOG_F(INFO, "Socket %d: kept alive", fd);
+
+        if (EXIT_SUCCESS != uring_connection_new(loop, fd))
+        {
+            LOG_F(ERROR, "Socket %d: Unable to add to pool. Internal error",
+                  fd);
+
+            if (EXIT_SUCCESS != server_close(loop->server, fd))
+                rc = ERROR_SERVER_CLOSE;
+        }
+    }
+
+    if (EXIT_SUCCESS == rc && server_running(loop->server))
+        rc = uring_arm_poll(loop, loop->server->returned[0], URING_OP_RETURN);
+
+    return rc;
+}
+
+static int server_uring_loop(server_t *const server,
+                             const server_listeners_t *const listeners)
+{
+    uring_loop_t loop = {server, NULL, listeners, NULL, 0, 0, 0, 0,
+                         request_blank(REQUEST_SIZE), handler_call_init(),
+                         timer_wheel_init(), server->timeout};
+    int rc = EXIT_SUCCESS;
+
+    loop.ring = uring_init(URING_ENTRIES);
+
+    if (NULL == loop.ring)
+    {
+        LOG_M(ERROR, "Unable to setup io_uring");
+        rc = ERROR_SERVER_URING;
+    }
+
+    // Requests for immediate handlers are answered by the loop itself
+    if (EXIT_SUCCESS == rc
+        && (NULL == loop.request || NULL == loop.call
+            || EXIT_SUCCESS != request_set_limits(loop.request,
+                                                  &server->requests)
+            || NULL == loop.timers))
+        rc = ERROR_SERVER_ALLOCATION;
+
+    if (EXIT_SUCCESS == rc
+        && EXIT_SUCCESS != uring_buffers_init(loop.ring, URING_BUFFER_COUNT,
+                                              URING_BUFFER_SIZE))
+    {
+        LOG_M(ERROR, "Unable to register io_uring buffers");
+        rc = ERROR_SERVER_URING;
+    }
+
+    if (EXIT_SUCCESS == rc)
+        rc = uring_accept_all(&loop, 1);
+
+    if (EXIT_SUCCESS == rc)
+        rc = uring_arm_poll(&loop, server->control, URING_OP_CONTROL);
+
+    if (EXIT_SUCCESS == rc)
+        rc = uring_arm_poll(&loop, signal_fd, URING_OP_CONTROL);
+
+    if (EXIT_SUCCESS == rc)
+        rc = uring_arm_poll(&loop, server->returned[0], URING_OP_RETURN);
+
+    if (EXIT_SUCCESS == rc)
+        LOG_M(INFO, "Server up");
+
+    while (EXIT_SUCCESS == rc && server_running(server)
+           && !(loop.drained && 0 == loop.active))
+    {
+        // Drain takes accept off the ring, paused one is simply not resumed
+        if (!loop.drained && server_draining(server))
+        {
+            LOG_M(INFO, "Draining");
+
+            if (0 == loop.resume)
+                rc = uring_accept_all(&loop, 0);
+
+            loop.resume = 0;
+            loop.drained = 1;
+        }
+
+        // Everything queued during previous pass is submitted by one call.
+        // Wait is cut short by the closest timer, as in multiplexer_wait.
+        size_t wait = uring_resume_accept(&loop, &rc);
+        size_t next = timer_wheel_next(loop.timers);
+
+        if (TIMER_WHEEL_NONE != next && (0 == wait || wait > next))
+            wait = next ? next : 1;
+
+        if (EXIT_SUCCESS == rc)
+            rc = uring_submit(loop.ring, 1, wait);
+
+        if (EXIT_SUCCESS != rc)
+        {
+            LOG_M(ERROR, "io_uring wait error");
+            rc = ERROR_SERVER_URING;
+        }
+
+        for (struct io_uring_cqe *cqe = NULL;
+             EXIT_SUCCESS == rc && NULL != (cqe = uring_cqe(loop.ring));)
+        {
+            switch (cqe->user_data >> 56)
+            {
+                case (URING_OP_ACCEPT):
+                    rc = uring_process_accept(&loop, cqe);
+                    break;
+                case (URING_OP_RECV):
+                    rc = uring_process_recv(&loop, cqe);
+                    break;
+                case (URING_OP_CONTROL):
+                    rc = uring_process_control(&loop, cqe);
+                    break;
+                case (URING_OP_RETURN):
+                    rc = uring_process_return(&loop);
+                    break;
+            }
+
+            uring_cqe_seen(loop.ring);
+        }
+
+        // Remove timeout
+        if (EXIT_SUCCESS == rc)
+            rc = uring_process_timeout(&loop);
+    }
+
+    for (size_t fd = 0; loop.size > fd; fd++)
+        if (URING_CONNECTION_FREE != loop.connections[fd].state)
+            uring_release(&loop, fd);
+
+    // Connections returned, when nobody is going to take them, are closed
+    for (int fd = -1; sizeof(fd) == read(server->returned[0], &fd, sizeof(fd));)
+        close(fd);
+
+    free(loop.connections);
+    timer_wheel_free(&loop.timers);
+    uring_free(&loop.ring);
+    request_free(&loop.request);
+    handler_call_free(&loop.call);
+
+    return rc;
+}
+
+static socklen_t server_handoff_address(const server_t *const server,
+                                        struct sockaddr_un *const address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    // Leading zero of path puts socket into abstract namespace
+    int len = snprintf(address->sun_path + 1, sizeof(address->sun_path) - 1,
+                       HANDOFF_NAME, server->port);
+
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+// Listeners are passed with SCM_RIGHTS in order of endpoints, message without
+// descriptors tells, that every shard binds its own
+static int server_handoff_send(const int socket,
+                               const server_listeners_t *const listeners)
+{
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * SERVER_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if (listeners->size)
+    {
+        size_t size = sizeof(int) * listeners->size;
+
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(size);
+
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(size);
+        memcpy(CMSG_DATA(header), listeners->fds, size);
+    }
+
+    if (1 != sendmsg(socket, &message, MSG_NOSIGNAL))
+        return ERROR_SERVER_WRITE;
+
+    return EXIT_SUCCESS;
+}
+
+// Instance, that is already running on the same port, is asked for its
+// listeners. Set stays empty, when there is no such instance or it has none
+// to give.
+static int server_takeover(const server_t *const server,
+                           server_listeners_t *const listeners)
+{
+    struct sockaddr_un address;
+    socklen_t len = server_handoff_address(server, &address);
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int rc = EXIT_SUCCESS;
+
+    listeners->size = 0;
+
+    if (-1 == socket_fd)
+        return ERROR_SERVER_ALLOCATION;
+
+    if (-1 == connect(socket_fd, (struct sockaddr *)&address, len))
+    {
+        close(socket_fd);
+
+        return EXIT_SUCCESS;
+    }
+
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * SERVER_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    if (1 != recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC))
+    {
+        LOG_M(ERROR, "Running instance didn't hand over listener");
+        rc = ERROR_SERVER_ACCEPT;
+    }
+
+    struct cmsghdr *header = EXIT_SUCCESS == rc ? CMSG_FIRSTHDR(&message)
+                                                : NULL;
+
+    if (NULL != header && SOL_SOCKET == header->cmsg_level
+        && SCM_RIGHTS == header->cmsg_type)
+    {
+        listeners->size = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(listeners->fds, CMSG_DATA(header),
+               sizeof(int) * listeners->size);
+        LOG_F(INFO, "%zu listeners taken over", listeners->size);
+    }
+
+    // Set of endpoints has to be the same, as listeners can't be told apart
+    if (listeners->size && server->endpoints_size != listeners->size)
+    {
+        LOG_M(ERROR, "Running instance has other endpoints");
+        server_listeners_close(listeners);
+        rc = ERROR_SERVER_INVALID;
+    }
+
+    close(socket_fd);
+
+    return rc;
+}
+
+// Abstract name has no permissions, so only peer of the same user is let to
+// take listener over
+static int server_handoff_trusted(const int socket)
+{
+    struct ucred credentials;
+    socklen_t len = sizeof(credentials);
+
+    return -1 != getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials,
+                            &len)
+           && geteuid() == credentials.uid;
+}
+
+// Waits for the next instance, hands listener over to it and drains this one,
+// so that connections, which are already taken, are finished
+static void *server_handoff_main(void *arg)
+{
+    server_t *server = arg;
+    struct pollfd fds[2] = {{server->handoff[0], POLLIN, 0},
+                            {server->handoff[1], POLLIN, 0}};
+    int peer = -1;
+    int ready = 1;
+
+    while (-1 == peer && -1 != ready)
+    {
+        while (-1 == (ready = poll(fds, 2, -1)) && EINTR == errno);
+
+        if (-1 == ready || POLLIN & fds[1].revents
+            || !(POLLIN & fds[0].revents))
+            break;
+
+        peer = accept4(server->handoff[0], NULL, NULL, SOCK_CLOEXEC);
+
+        if (-1 != peer && !server_handoff_trusted(peer))
+        {
+            LOG_M(WARNING, "Upgrade: peer of other user refused");
+            close(peer);
+            peer = -1;
+        }
+    }
+
+    // Name is freed before listener is sent, so that new instance could take
+    // it for the next upgrade
+    close(server->handoff[0]);
+
+    if (-1 != peer)
+    {
+        LOG_M(INFO, "Upgrade: listener handed over");
+
+        if (EXIT_SUCCESS != server_handoff_send(peer,
+                                                &server->handoff_listen))
+            LOG_M(ERROR, "Upgrade: unable to hand listener over");
+
+        close(peer);
+        server_control(server, SERVER_CONTROL_DRAIN);
+    }
+
+    return NULL;
+}
+
+static int server_handoff_start(server_t *const server,
+                                const server_listeners_t *const listeners)
+{
+    struct sockaddr_un address;
+    socklen_t len = server_handoff_address(server, &address);
+    int rc = EXIT_SUCCESS;
+
+    server->handoff_listen = *listeners;
+    server->handoff[0] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    server->handoff[1] = eventfd(0, EFD_CLOEXEC);
+
+    if (-1 == server->handoff[0] || -1 == server->handoff[1])
+        rc = ERROR_SERVER_ALLOCATION;
+
+    if (EXIT_SUCCESS == rc
+        && (-1 == bind(server->handoff[0], (struct sockaddr *)&address, len)
+            || -1 == listen(server->handoff[0], 1)))
+    {
+        LOG_M(ERROR, "Upgrade: unable to listen for next instance");
+        rc = ERROR_SERVER_ACCEPT;
+    }
+
+    if (EXIT_SUCCESS == rc && EXIT_SUCCESS != pthread_create(
+            &server->handoff_thread, NULL, server_handoff_main, server))
+        rc = ERROR_SERVER_ALLOCATION;
+
+    if (EXIT_SUCCESS != rc)
+    {
+        for (size_t i = 0; 2 > i; i++)
+            if (-1 != server->handoff[i])
+                close(server->handoff[i]);
+
+        server->handoff[0] = server->handoff[1] = -1;
+    }
+
+    return rc;
+}
+
+static void server_handoff_stop(server_t *const server)
+{
+    uint64_t value = 1;
+
+    if (-1 == server->handoff[1])
+        return;
+
+    if (sizeof(value) == write(server->handoff[1], &value, sizeof(value)))
+        pthread_join(server->handoff_thread, NULL);
+
+    close(server->handoff[1]);
+    server->handoff[0] = server->handoff[1] = -1;
+}
+
+static int server_mode_loop(server_t *const server,
+                            const server_listeners_t *const listeners)
+{
+    int rc = EXIT_SUCCESS;
+
+    if (SERVER_MODE_SHARDED == server->mode)
+        rc = server_sharded_loop(server);
+    else if (SERVER_MODE_LEADER == server->mode)
+        rc = server_followers_loop(server, listeners);
+    else if (SERVER_ENGINE_URING == server->engine)
+        rc = server_uring_loop(server, listeners);
+    else
+        rc = server_reactor_loop(server, listeners);
+
+    return rc;
+}
+
+typedef struct
+{
+    pid_t pid;
+    size_t spawned;
+} server_child_t;
+
+// Descriptors, that are waited on, can't be shared with master after fork:
+// epoll set and eventfd would be the same objects. Listener and signalfd are
+// kept, the latter reads signals of the process, that reads it.
+static int server_prefork_reset(server_t *const server)
+{
+    int rc = EXIT_SUCCESS;
+
+    multiplexer_free(&server->multiplexer);
+    close(server->control);
+
+    for (size_t i = 0; 2 > i; i++)
+        close(server->returned[i]);
+
+    // Upgrade is served by master only
+    for (size_t i = 0; 2 > i; i++)
+        if (-1 != server->handoff[i])
+            close(server->handoff[i]);
+
+    server->handoff[0] = server->handoff[1] = -1;
+    server->upgrade = 0;
+    server->drained = 0;
+    __atomic_store_n(&server->pending, 0, __ATOMIC_RELEASE);
+    server->multiplexer = multiplexer_init(server->multiplexer_type);
+    server->control = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (-1 == pipe2(server->returned, O_NONBLOCK | O_CLOEXEC))
+        server->returned[0] = server->returned[1] = -1;
+
+    if (NULL == server->multiplexer || -1 == server->control
+        || -1 == server->returned[0])
+        rc = ERROR_SERVER_ALLOCATION;
+
+    return rc;
+}
+
+static pid_t server_prefork_spawn(server_t *const server,
+                                  const server_listeners_t *const listeners)
 {
-    if (NULL == server)
-        return ERROR_SERVER_NULL;
+    pid_t pid = fork();
 
-    server->timeout = timeout;
+    if (0 != pid)
+        return pid;
 
-    return EXIT_SUCCESS;
+    int rc = server_prefork_reset(server);
+
+    if (EXIT_SUCCESS == rc && SERVER_MODE_DISPATCH == server->mode)
+        rc = setup_threads(server);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_mode_loop(server, listeners);
+
+    stop_threads(server);
+    LOG_F(INFO, "Child %d down", getpid());
+
+    exit(EXIT_SUCCESS == rc ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
-int server_register_handler(server_t *const server,
-                            const handler_t *const handler)
+// Takes exited children and schedules their respawn
+static void server_prefork_reap(server_child_t *const children,
+                                const size_t size)
 {
-    if (NULL == server)
-        return ERROR_SERVER_NULL;
+    int status;
 
-    return handler_list_push(server->list, handler);
+    for (pid_t pid; 0 < (pid = waitpid(-1, &status, WNOHANG));)
+        for (size_t i = 0; size > i; i++)
+            if (children[i].pid == pid)
+            {
+                if (WIFSIGNALED(status))
+                    LOG_F(WARNING, "Child %d killed by signal %d", pid,
+                          WTERMSIG(status));
+                else
+                    LOG_F(WARNING, "Child %d exited with %d", pid,
+                          WEXITSTATUS(status));
+
+                children[i].pid = -1;
+            }
 }
 
-static int server_process_connections(server_t *const server,
-                                      const int listen_fd,
-                                      list_t *const ready)
+// Starts every child, that is missing and isn't held by backoff. Time until
+// the closest held one is returned, 0 if none is.
+static size_t server_prefork_fill(server_t *const server,
+                                  server_child_t *const children,
+                                  const size_t size,
+                                  const server_listeners_t *const listeners)
 {
-    int rc = EXIT_SUCCESS;
-
-    list_iterator_t *iter = list_begin(ready), *end = list_end(ready);
+    size_t now = timer_wheel_clock(), wait = 0;
 
-    if (NULL == iter || NULL == end)
+    for (size_t i = 0; size > i; i++)
     {
-        LOG_M(ERROR, "Unable to access socket pool");
-        rc = ERROR_SERVER_ALLOCATION;
-    }
+        if (-1 != children[i].pid)
+            continue;
 
-    for (; EXIT_SUCCESS == rc && list_iterator_ne(iter, end);
-         list_iterator_next(iter))
-    {
-        int *socket = list_iterator_get(iter);
+        size_t due = children[i].spawned + PREFORK_BACKOFF;
 
-        if (NULL == socket)
-        {
-            LOG_M(ERROR, "Unable to access socket");
-            rc = ERROR_SERVER_LIST;
-        }
-        else
+        if (children[i].spawned && due > now)
         {
-            if (listen_fd != *socket)
-            {
-                LOG_F(INFO, "Socket %d: ready", *socket);
-                int drc = worker_request_dispatch(server->workers,
-                                                  server->max_threads,
-                                                  *socket);
-
-                if (EXIT_SUCCESS != drc)
-                {
-                    LOG_F(WARNING, "Socket %d: connection refused", *socket);
-                    rc = server_refuse_connection(*socket);
-
-                    if (EXIT_SUCCESS != close(*socket))
-                        rc = rc ? rc : ERROR_SERVER_CLOSE;
-                }
-
-                int rrc = multiplexer_remove(server->multiplexer, *socket);
-
-                if (EXIT_SUCCESS == rc && EXIT_SUCCESS == drc && EXIT_SUCCESS == rrc)
-                    LOG_F(INFO, "Socket %d: dispatched and removed from pool", *socket);
-                else if (EXIT_SUCCESS != rc)
-                    LOG_F(ERROR, "Socket %d: unable to refuse", *socket);
-                else if (EXIT_SUCCESS != rrc)
-                {
-                    LOG_F(ERROR, "Socket %d: unable to remove socket from pool", *socket);
-                    rc = rrc;
-                }
-            }
-            else
-            {
-                int conn_fd = accept(listen_fd, NULL, NULL);
+            if (0 == wait || due - now < wait)
+                wait = due - now;
 
-                if (-1 != conn_fd)
-                    LOG_F(INFO, "New connection: %d", conn_fd);
-                else
-                {
-                    LOG_M(ERROR, "Unable to accept connection");
-                    rc = ERROR_SERVER_ACCEPT;
-                }
-
-                if (EXIT_SUCCESS == rc)
-                {
-                    rc = multiplexer_add(server->multiplexer, conn_fd,
-                                         READ | WRITE, server->timeout);
-
-                    if (ERROR_MULTIPLEXER_OVERFLOW == rc)
-                    {
-                        LOG_F(ERROR, "Socket %d: unable to add to pool. Overflow", conn_fd);
-                        // rc = server_refuse_connection(conn_fd);
-                        if (EXIT_SUCCESS != close(conn_fd))
-                            rc = ERROR_SERVER_CLOSE;
-                        else
-                            rc = EXIT_SUCCESS;
-                    }
-                    else if (EXIT_SUCCESS != rc)
-                    {
-                        LOG_F(ERROR, "Socket %d: Unable to add to pool. Internal error", conn_fd);
-                        // server_refuse_connection(conn_fd);
-                        if (EXIT_SUCCESS != close(conn_fd))
-                            rc = ERROR_SERVER_CLOSE;
-                        else
-                            rc = EXIT_SUCCESS;
-                    }
-                }
-            }
+            continue;
         }
-    }
 
-    list_iterator_free(&iter);
-    list_iterator_free(&end);
+        children[i].spawned = now;
+        children[i].pid = server_prefork_spawn(server, listeners);
 
-    return rc;
+        if (-1 == children[i].pid)
+            LOG_M(ERROR, "Unable to fork");
+        else
+            LOG_F(INFO, "Child %d up", children[i].pid);
+    }
+
+    return wait;
 }
 
-static int server_process_timeout(list_t *const deleted)
+// Master only keeps children running: they are forked with listener and
+// respawned, when they exit. Reload, drain and stop are passed to them as
+// signals, drained children aren't respawned.
+static int server_prefork_loop(server_t *const server,
+                               const server_listeners_t *const listeners)
 {
+    size_t size = server->processes, wait = 0, alive = 0;
+    int drained = 0;
+    server_child_t *children = malloc(size * sizeof(server_child_t));
+    multiplexer_event_t events[SERVER_EVENTS];
+    size_t count = 0;
     int rc = EXIT_SUCCESS;
 
-    list_iterator_t *iter = list_begin(deleted), *end  = list_end(deleted);
+    if (NULL == children)
+        rc = ERROR_SERVER_ALLOCATION;
 
-    if (NULL == iter || NULL == end)
+    for (size_t i = 0; EXIT_SUCCESS == rc && size > i; i++)
     {
-        LOG_M(ERROR, "Unable to access socket pool");
-        rc = ERROR_SERVER_ALLOCATION;
+        children[i].pid = -1;
+        children[i].spawned = 0;
     }
 
-    for (; EXIT_SUCCESS == rc && list_iterator_ne(iter, end);
-         list_iterator_next(iter))
-    {
-        int *socket = list_iterator_get(iter);
+    if (EXIT_SUCCESS == rc)
+        rc = server_control_register(server, server->multiplexer);
+
+    if (EXIT_SUCCESS == rc)
+        LOG_M(INFO, "Server up");
 
-        if (NULL != socket)
+    while (EXIT_SUCCESS == rc && server_running(server)
+           && !(drained && 0 == alive))
+    {
+        if (!drained && server_draining(server))
         {
-            LOG_F(WARNING, "Socket %d: timeout", *socket);
-            server_refuse_connection(*socket);
+            LOG_M(INFO, "Draining");
+            drained = 1;
+
+            for (size_t i = 0; size > i; i++)
+                if (-1 != children[i].pid)
+                    kill(children[i].pid, SIGQUIT);
         }
 
-        if (NULL == socket)
+        if (!drained)
+            wait = server_prefork_fill(server, children, size, listeners);
+        else
+            wait = 0;
+
+        rc = multiplexer_wait(server->multiplexer, events, SERVER_EVENTS,
+                              &count, wait);
+
+        for (size_t i = 0; EXIT_SUCCESS == rc && count > i; i++)
         {
-            LOG_M(ERROR, "Unable to access socket");
-            rc = ERROR_SERVER_LIST;
+            int commands = 0;
+
+            if (signal_fd == events[i].fd)
+                rc = server_signal_read();
+            else
+                commands = server_control_take(server);
+
+            for (size_t j = 0; SERVER_CONTROL_RELOAD & commands && size > j;
+                 j++)
+                if (-1 != children[j].pid)
+                    kill(children[j].pid, SIGHUP);
         }
-        else if (EXIT_SUCCESS != close(*socket))
-            rc = ERROR_SERVER_CLOSE;
+
+        server_prefork_reap(children, size);
+
+        alive = 0;
+
+        for (size_t i = 0; size > i; i++)
+            if (-1 != children[i].pid)
+                alive++;
     }
 
-    list_iterator_free(&iter);
-    list_iterator_free(&end);
+    for (size_t i = 0; NULL != children && size > i; i++)
+        if (-1 != children[i].pid)
+            kill(children[i].pid, SIGTERM);
+
+    for (size_t i = 0; NULL != children && size > i; i++)
+        if (-1 != children[i].pid)
+            waitpid(children[i].pid, NULL, 0);
+
+    server_control_unregister(server, server->multiplexer);
+    free(children);
 
     return rc;
 }
@@ -346,115 +3605,78 @@ int server_mainloop(server_t *const server)
         return ERROR_SERVER_NOT_SETUP;
     }
 
-    int rc = setup_threads(server);
-
-    int listen_fd = 0;
-    struct sockaddr_in serv_addr;
-    server_status_t *status = NULL;
-    list_t *sockets = NULL;
-
-    if (EXIT_SUCCESS == rc)
-    {
-        status = status_register(server);
-
-        if (NULL == status)
-        {
-            LOG_M(ERROR, "Unable to register server watcher");
-            rc = errno;
-        }
-    }
+    int rc = EXIT_SUCCESS;
 
-    if (EXIT_SUCCESS == rc)
+    if (SERVER_MODE_DISPATCH != server->mode
+        && SERVER_ENGINE_URING == server->engine)
     {
-        sockets = list_init(sizeof(int));
-
-        if (NULL == sockets)
-        {
-            LOG_M(ERROR, "Unable to allocate list of sockets");
-            rc = errno;
-        }
+        LOG_M(ERROR, "Only dispatch mode is supported by uring engine");
+        rc = ERROR_SERVER_MODE;
     }
 
-    if (EXIT_SUCCESS == rc
-        && (-1 == (listen_fd = socket(AF_INET, SOCK_STREAM, 0))))
-    {
-        LOG_M(ERROR, "Unable to create socket");
-        rc = EXIT_FAILURE;
-    }
+    server_resolve_capacity(server);
+    __atomic_store_n(&server->looping, 1, __ATOMIC_RELEASE);
 
-    if (EXIT_SUCCESS == rc)
+    if (EXIT_SUCCESS == rc && NULL != server->host)
     {
-        int flags = fcntl(listen_fd, F_GETFL, 0);
-        flags |= O_NONBLOCK;
-        fcntl(listen_fd, F_SETFL, flags);
+        LOG_M(ERROR, "Server is attached to another one");
+        rc = ERROR_SERVER_MODE;
     }
 
-    if (EXIT_SUCCESS == rc)
+    // Port of server_init is listened on every IPv4 address by default
+    if (EXIT_SUCCESS == rc && 0 == server->endpoints_own)
     {
-        int on = 1;
-        rc = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-    }
+        server_endpoint_t endpoint = {AF_INET, NULL, server->port, 0};
 
-    if (EXIT_SUCCESS == rc)
-    {
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        serv_addr.sin_port = htons(server->port);
+        rc = server_add_endpoint(server, &endpoint);
     }
 
-    if (EXIT_SUCCESS == rc
-        && (-1 == bind(listen_fd, (struct sockaddr *)&serv_addr,
-                       sizeof(serv_addr))))
-    {
-        LOG_M(ERROR, "Unable to bind socket");
-        rc = EXIT_FAILURE;
-    }
+    // Other modes serve requests by themselves and don't need workers. Under
+    // prefork workers are started by every child after fork.
+    if (EXIT_SUCCESS == rc && SERVER_MODE_DISPATCH == server->mode
+        && 0 == server->processes)
+        rc = setup_threads(server);
 
-    if (EXIT_SUCCESS == rc && (-1 == listen(listen_fd, SOMAXCONN)))
-    {
-        LOG_M(ERROR, "Unable to mark socket as listen");
-        rc = EXIT_FAILURE;
-    }
+    server_listeners_t listeners = {{0}, 0};
+    server_status_t *status = NULL;
 
     if (EXIT_SUCCESS == rc)
     {
-        rc = multiplexer_add(server->multiplexer, listen_fd, READ, 0);
+        status = status_register(server);
 
-        if (EXIT_SUCCESS != rc)
+        if (NULL == status)
         {
-            LOG_F(ERROR, "Unable to add socket %d to pool", listen_fd);
-            rc = ERROR_SERVER_MULTIPLEXING;
+            LOG_M(ERROR, "Unable to register server watcher");
+            rc = errno;
         }
     }
 
-    if (EXIT_SUCCESS == rc)
-        LOG_M(INFO, "Server up");
+    // Shards take over by themselves, once they listen
+    int upgrade = server->upgrade && SERVER_MODE_SHARDED != server->mode;
 
-    while (EXIT_SUCCESS == rc && status->run)
-    {
-        rc = multiplexer_wait(server->multiplexer, sockets, TIMEOUT_MULTIPLEXER);
+    if (EXIT_SUCCESS == rc && upgrade)
+        rc = server_takeover(server, &listeners);
 
-        // Process ready
-        if (EXIT_SUCCESS == rc)
-            rc = server_process_connections(server, listen_fd, sockets);
+    if (EXIT_SUCCESS == rc && SERVER_MODE_SHARDED != server->mode
+        && 0 == listeners.size)
+        rc = server_listen(server, &listeners, 0, NULL, -1);
 
-        // Remove timeout
-        if (EXIT_SUCCESS == rc)
-            rc = multiplexer_timeout(server->multiplexer, sockets);
+    if (EXIT_SUCCESS == rc)
+        rc = server_routes_init(server);
 
-        if (EXIT_SUCCESS == rc)
-            rc = server_process_timeout(sockets);
+    if (EXIT_SUCCESS == rc)
+        rc = server_limiter_init(server);
 
-        // Wake up workers
-        if (EXIT_SUCCESS == rc)
-            rc = worker_wake_up(server->workers, server->max_threads);
-    }
+    if (EXIT_SUCCESS == rc && upgrade)
+        rc = server_handoff_start(server, &listeners);
 
-    if (0 != listen_fd)
-        close(listen_fd);
+    if (EXIT_SUCCESS == rc && server->processes)
+        rc = server_prefork_loop(server, &listeners);
+    else if (EXIT_SUCCESS == rc)
+        rc = server_mode_loop(server, &listeners);
 
-    multiplexer_clear(server->multiplexer);
-    list_free(&sockets);
+    server_handoff_stop(server);
+    server_listeners_close(&listeners);
 
     if (status)
     {
@@ -467,6 +3689,9 @@ int server_mainloop(server_t *const server)
             LOG_M(ERROR, "Unable to drop server watcher");
     }
 
+    // Stop is kept until here, so that every thread of server could see it
+    __atomic_store_n(&server->pending, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&server->looping, 0, __ATOMIC_RELEASE);
     LOG_M(INFO, "Server down");
 
     return rc;
@@ -479,8 +3704,18 @@ void server_free(server_t **const server)
 
     stop_threads(*server);
     handler_list_free(&(*server)->list);
+    free((*server)->owners);
+    limiter_free(&(*server)->limiter);
     multiplexer_free(&(*server)->multiplexer);
     free((*server)->workers);
+
+    if (-1 != (*server)->control)
+        close((*server)->control);
+
+    for (size_t i = 0; 2 > i; i++)
+        if (-1 != (*server)->returned[i])
+            close((*server)->returned[i]);
+
     free(*server);
 
     *server = NULL;
@@ -494,10 +3729,10 @@ static int find_status_by_server(const void *const arg, const void *const value)
     return (server_t *)arg == ((server_status_t *)value)->server;
 }
 
-static server_status_t *status_register(const server_t *const server)
+static server_status_t *status_register(server_t *const server)
 {
     int rc = EXIT_SUCCESS;
-    server_status_t status_new = {server, 1};
+    server_status_t status_new = {server};
     int rclock = pthread_mutex_lock(&mutex);
     server_status_t *status = NULL;
 
@@ -541,30 +3776,143 @@ static int status_drop(const server_status_t *const status)
     return rc;
 }
 
-static int setup_threads(server_t *server)
+// Workers of slots from the given one up to max_threads are started
+static int server_start_workers(server_t *const server, const size_t from)
 {
     int rc = EXIT_SUCCESS;
-
-    if (server->init)
-        rc = stop_threads(server);
-
     char *base = (char *)server->workers;
     size_t size = worker_size();
     worker_callback_t callback;
     worker_error_t error;
+    worker_admission_t admission = server_get_admission(server);
     worker_callback_init(server, &callback);
-    worker_error_init(&error);
+    worker_error_init(server, &error);
 
-    for (size_t i = 0; EXIT_SUCCESS == rc && server->max_threads > i; i++)
+    for (size_t i = from; EXIT_SUCCESS == rc && server->max_threads > i; i++)
         rc = worker_init((void *)(base + i * size), server->list, &callback,
-                         &error);
+                         &error, &admission, &server->requests,
+                         server->affinity ? server_cpu(i) : -1);
+
+    return rc;
+}
+
+static int setup_threads(server_t *server)
+{
+    int rc = EXIT_SUCCESS;
+
+    if (server->init)
+        rc = stop_threads(server);
+
+    if (EXIT_SUCCESS == rc)
+        rc = server_start_workers(server, 0);
 
     if (EXIT_SUCCESS == rc)
-        server->init = 1;
+        __atomic_store_n(&server->init, 1, __ATOMIC_RELEASE);
+
+    return rc;
+}
+
+// Runs on event loop, which is the only one to dispatch, so workers may be
+// stopped and their array moved. Shrinking stops only the extra workers,
+// growing beyond the array restarts all of them.
+static int server_resize_workers(server_t *const server)
+{
+    size_t threads = __atomic_load_n(&server->resize, __ATOMIC_RELAXED);
+    char *base = (char *)server->workers;
+    size_t size = worker_size();
+    int rc = EXIT_SUCCESS;
+
+    if (threads == server->max_threads)
+        return EXIT_SUCCESS;
+
+    // Slots of stopped workers may be reused only, once they have exited, so
+    // growth waits until they are reaped
+    if (threads > server->max_threads && server->retired > server->max_threads)
+    {
+        LOG_F(WARNING, "Worker pool grows to %zu, once stopped workers exit",
+              threads);
+
+        return EXIT_SUCCESS;
+    }
+
+    LOG_F(WARNING, "Worker pool is resized from %zu to %zu",
+          server->max_threads, threads);
+
+    // Extra workers are only told to stop, so that loop doesn't wait for
+    // their queues. They are reaped, once every one of them has exited.
+    if (threads < server->max_threads)
+    {
+        for (size_t i = threads; server->max_threads > i; i++)
+            if (EXIT_SUCCESS != worker_stop((worker_t *)(base + i * size)))
+                LOG_F(ERROR, "Unable to stop worker %zu", i);
+
+        if (server->retired < server->max_threads)
+            server->retired = server->max_threads;
+
+        __atomic_store_n(&server->max_threads, threads, __ATOMIC_RELAXED);
+
+        return EXIT_SUCCESS;
+    }
+
+    // Workers starting from this slot are stopped and started again
+    size_t from = threads > server->workers_capacity ? 0 : server->max_threads;
+
+    for (size_t i = from; server->max_threads > i; i++)
+        worker_destroy((worker_t *)(base + i * size));
+
+    if (threads > server->workers_capacity)
+    {
+        worker_t *workers = realloc(server->workers, size * threads);
+
+        if (NULL != workers)
+        {
+            server->workers = workers;
+            server->workers_capacity = threads;
+        }
+    }
+
+    // Without a new array the old size is started again
+    if (threads > server->workers_capacity)
+        LOG_M(ERROR, "Unable to grow worker pool");
+    else
+        __atomic_store_n(&server->max_threads, threads, __ATOMIC_RELAXED);
+
+    server->retired = server->max_threads;
+
+    if (server->max_threads > from)
+        rc = server_start_workers(server, from);
+
+    if (EXIT_SUCCESS != rc)
+        LOG_M(ERROR, "Unable to restart workers");
 
     return rc;
 }
 
+// Workers stopped on resize are joined, once every one of them has exited,
+// so that it doesn't block. Growth, that has waited for them, goes on then.
+static int server_reap_workers(server_t *const server)
+{
+    char *base = (char *)server->workers;
+    size_t size = worker_size();
+
+    if (server->retired <= server->max_threads)
+        return EXIT_SUCCESS;
+
+    for (size_t i = server->max_threads; server->retired > i; i++)
+        if (!worker_is_finished((worker_t *)(base + i * size)))
+            return EXIT_SUCCESS;
+
+    for (size_t i = server->max_threads; server->retired > i; i++)
+        worker_destroy((worker_t *)(base + i * size));
+
+    LOG_F(INFO, "%zu stopped workers reaped",
+          server->retired - server->max_threads);
+    server->retired = server->max_threads;
+
+    return server_resize_workers(server);
+}
+
+// Stopped workers, that haven't been reaped, are waited for as well
 static int stop_threads(server_t *server)
 {
     if (!server->init)
@@ -572,28 +3920,83 @@ static int stop_threads(server_t *server)
 
     char *base = (char *)server->workers;
     size_t size = worker_size();
+    size_t count = server->retired > server->max_threads ? server->retired
+                                                         : server->max_threads;
 
-    for (size_t i = 0; server->max_threads > i; i++)
+    for (size_t i = 0; count > i; i++)
         worker_destroy((worker_t *)(base + i * size));
 
+    server->retired = server->max_threads;
+
     int rc = multiplexer_clear(server->multiplexer);
 
     if (EXIT_SUCCESS != rc)
         rc = ERROR_SERVER_MULTIPLEXING;
 
-    server->init = 0;
+    __atomic_store_n(&server->init, 0, __ATOMIC_RELEASE);
 
     return rc;
 }
 
-static int worker_callback(void *arg, int socket)
+// Workers are restarted one by one, each of them serves tasks, that are
+// already queued, before exit
+static int server_reload_workers(server_t *const server)
+{
+    int rc = EXIT_SUCCESS;
+    char *base = (char *)server->workers;
+    size_t size = worker_size();
+    worker_callback_t callback;
+    worker_error_t error;
+    worker_admission_t admission = server_get_admission(server);
+
+    worker_callback_init(server, &callback);
+    worker_error_init(server, &error);
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && server->max_threads > i; i++)
+    {
+        worker_t *worker = (worker_t *)(base + i * size);
+
+        worker_destroy(worker);
+        rc = worker_init(worker, server->list, &callback, &error,
+                         &admission, &server->requests,
+                         server->affinity ? server_cpu(i) : -1);
+    }
+
+    if (EXIT_SUCCESS != rc)
+        LOG_M(ERROR, "Unable to restart workers");
+
+    return rc;
+}
+
+// Connection, that stays open, goes back to the pool to wait for the next
+// request. Ring of uring loop can't be touched from worker, so the loop takes
+// it back from pipe.
+static int worker_callback(void *arg, int socket, int keep)
 {
     if (NULL == arg)
         return ERROR_WORKER_NULL;
 
-    int rc = EXIT_SUCCESS;
+    server_t *server = arg;
+    int rc = EXIT_SUCCESS, kept = 0;
+
+    if (0 > socket)
+        return EXIT_SUCCESS;
+
+    if (keep && server_running(server) && !server_draining(server))
+    {
+        if (SERVER_ENGINE_URING == server->engine)
+            kept = sizeof(socket) == write(server->returned[1], &socket,
+                                           sizeof(socket));
+        else
+            kept = EXIT_SUCCESS == multiplexer_add(server->multiplexer,
+                                                   socket, READ,
+                                                   server_get_timeout(server));
+
+        if (!kept)
+            LOG_F(WARNING, "Socket %d: unable to keep alive", socket);
+    }
 
-    if (0 <= socket && EXIT_SUCCESS != close(socket))
+    if (!kept && EXIT_SUCCESS != server_close(server, socket))
         rc = ERROR_SERVER_CLOSE;
 
     return rc;
@@ -602,13 +4005,16 @@ static int worker_callback(void *arg, int socket)
 static void worker_callback_init(server_t *server, worker_callback_t *callback)
 {
     callback->func = worker_callback;
-    callback->arg = server->multiplexer;
+    callback->arg = server;
 }
 
-#define FORM                                 \
+#define HEADER                               \
 "HTTP/1.1 %d %s\r\n"                         \
 "Content-Type: text/html; charset=UTF-8\r\n" \
-"\r\n"                                       \
+"Content-Length: %d\r\n"                     \
+"Connection: close\r\n"                      \
+"\r\n"
+#define FORM                                 \
 "<html>"                                     \
     "<head>"                                 \
         "<title>Error occured</title>"       \
@@ -621,8 +4027,60 @@ static void worker_callback_init(server_t *server, worker_callback_t *callback)
 
 static void worker_error_func(void *arg, int socket, int error)
 {
-    if (NULL != arg)
+    if (NULL == arg)
+        return;
+
+    // Worker itself is down, it is woken up by event loop
+    if (-1 == socket)
+    {
+        server_control(arg, SERVER_CONTROL_WORKER);
+
+        return;
+    }
+
+    // Shed by admission, answered the same way as refused on dispatch
+    if (WORKER_ERROR_OVERLOAD == error)
+    {
+        server_count(&((server_t *)arg)->counters.refused);
+        server_refuse_connection(socket);
+
+        return;
+    }
+
+    // Pipelined request, that has found bucket of its client empty
+    if (WORKER_ERROR_LIMITED == error)
+    {
+        recv(socket, NULL, REQUEST_SIZE, MSG_DONTWAIT | MSG_TRUNC);
+        server_limit_reply(arg, socket);
+
+        return;
+    }
+
+    if (WORKER_ERROR_TIMEOUT == error)
+    {
+        server_timeout_reply(arg, socket);
+
+        return;
+    }
+
+    // Client doesn't take what is sent, so it is only cut off. Connection is
+    // reset on close, instead of sending what is left in socket buffer.
+    if (WORKER_ERROR_SLOW == error)
+    {
+        struct linger linger = {1, 0};
+
+        server_count(&((server_t *)arg)->counters.slow);
+        setsockopt(socket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
         return;
+    }
+
+    // Rest of request, that is over limits or can't be framed, is discarded,
+    // so that close doesn't reset connection before reply
+    if (WORKER_ERROR_LONG_LINE == error || WORKER_ERROR_LARGE_HEADER == error
+        || WORKER_ERROR_LARGE_BODY == error
+        || WORKER_ERROR_BAD_REQUEST == error)
+        recv(socket, NULL, REQUEST_SIZE, MSG_DONTWAIT | MSG_TRUNC);
 
     int code = 500;
     const char *msg = "Internal Server Error";
@@ -635,6 +4093,26 @@ static void worker_error_func(void *arg, int socket, int error)
             msg  = "Not Implemented";
             desc = "Server can't process such request";
             break;
+        case (WORKER_ERROR_BAD_REQUEST):
+            code = 400;
+            msg  = "Bad Request";
+            desc = "Request can't be framed";
+            break;
+        case (WORKER_ERROR_LONG_LINE):
+            code = 414;
+            msg  = "URI Too Long";
+            desc = "Request line is too long";
+            break;
+        case (WORKER_ERROR_LARGE_BODY):
+            code = 413;
+            msg  = "Content Too Large";
+            desc = "Request body is too large";
+            break;
+        case (WORKER_ERROR_LARGE_HEADER):
+            code = 431;
+            msg  = "Request Header Fields Too Large";
+            desc = "Request header is too large";
+            break;
         case (WORKER_ERROR_READ):
         case (WORKER_ERROR_WRONG_READ):
         case (WORKER_ERROR_INVALID_ACTION):
@@ -646,27 +4124,31 @@ static void worker_error_func(void *arg, int socket, int error)
             break;
     }
 
-    ssize_t len = snprintf(NULL, 0, FORM, code, msg, desc);
-    char *buffer = malloc(len + 1);
+    int blen = snprintf(NULL, 0, FORM, desc);
+    ssize_t len = snprintf(NULL, 0, HEADER FORM, code, msg, blen, desc);
+    char *buffer = 0 > blen || 0 > len ? NULL : malloc(len + 1);
 
     if (!buffer)
         return;
 
-    snprintf(buffer, len + 1, FORM, code, msg, desc);
+    snprintf(buffer, len + 1, HEADER FORM, code, msg, blen, desc);
     send(socket, buffer, len, 0);
     free(buffer);
 }
 
-static void worker_error_init(worker_error_t *error)
+static void worker_error_init(server_t *server, worker_error_t *error)
 {
     error->func = worker_error_func;
-    error->arg = NULL;
+    error->arg = server;
 }
 
-#define REFUSE_MESSAGE                                                  \
+#define REFUSE_HEADER                                                   \
 "HTTP/1.1 503 Service Unavailable\r\n"                                  \
 "Content-Type: text/html; charset=UTF-8\r\n"                            \
-"\r\n"                                                                  \
+"Content-Length: %zu\r\n"                                               \
+"Connection: close\r\n"                                                 \
+"\r\n"
+#define REFUSE_MESSAGE                                                  \
 "<html>"                                                                \
     "<head>"                                                            \
         "<title>Resource Busy</title>"                                  \
@@ -680,14 +4162,13 @@ static void worker_error_init(worker_error_t *error)
 
 static int server_refuse_connection(int socket)
 {
-    static ssize_t len = -1;
-
-    if (-1 == len)
-        len = strlen(REFUSE_MESSAGE);
+    char buffer[sizeof(REFUSE_HEADER REFUSE_MESSAGE) + 16];
+    ssize_t len = snprintf(buffer, sizeof(buffer), REFUSE_HEADER REFUSE_MESSAGE,
+                           sizeof(REFUSE_MESSAGE) - 1);
 
     int rc = EXIT_SUCCESS;
 
-    if (len != send(socket, REFUSE_MESSAGE, len, 0))
+    if (len != send(socket, buffer, len, 0))
         rc = ERROR_SERVER_WRITE;
 
     return rc;
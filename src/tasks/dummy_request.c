@@ -22,7 +22,8 @@ static int func(const int fd, const request_t *const request, void *arg)
     if (0 > fd || NULL == request || NULL != arg)
         return EXIT_FAILURE;
 
-    static const char *const message = "HTTP/1.1 200 OK\r\n\r\n";
+    static const char *const message = "HTTP/1.1 200 OK\r\n"
+                                       "Content-Length: 0\r\n\r\n";
     static ssize_t len = -1;
 
     if (-1 == len)
@@ -30,7 +31,7 @@ static int func(const int fd, const request_t *const request, void *arg)
 
     int rc = EXIT_SUCCESS;
 
-    if (len != send(fd, message, len, 0))
+    if (len != send(fd, message, len, MSG_DONTWAIT))
         rc = EXIT_FAILURE;
 
     return rc;
@@ -38,7 +39,7 @@ static int func(const int fd, const request_t *const request, void *arg)
 
 handler_t dummy_request_get(void)
 {
-    handler_t handler = {check, func, NULL, NULL};
+    handler_t handler = {check, func, NULL, NULL, 1};
 
     return handler;
 }
@@ -109,8 +109,10 @@ static int func(const int fd, const request_t *const request, void *arg)
 
     char *message = NULL;
     int is_free = 0;
-    static char *const not_found = "HTTP/1.1 404 Not Found\r\n\r\n";
-    static const char *const format = "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n%s\r\n";
+    static char *const not_found = "HTTP/1.1 404 Not Found\r\n"
+                                   "Content-Length: 0\r\n\r\n";
+    static const char *const format = "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+                                      "Content-Length: %ld\r\n%s\r\n";
     ssize_t len;
 
     const request_title_t *title = request_title(request);
@@ -137,16 +139,10 @@ static int func(const int fd, const request_t *const request, void *arg)
     }
     else
     {
-        int hlen = snprintf(NULL, 0, format, type->mime, type->addition);
+        int hlen = 0;
         long blen = 0;
 
-        if (0 > hlen)
-        {
-            LOG_M(ERROR, "sprintf error");
-            rc = EXIT_FAILURE;
-        }
-
-        if (EXIT_SUCCESS == rc && -1 == fseek(file, 0, SEEK_END))
+        if (-1 == fseek(file, 0, SEEK_END))
         {
             LOG_M(ERROR, "fseek error");
             rc = EXIT_FAILURE;
@@ -169,9 +165,23 @@ static int func(const int fd, const request_t *const request, void *arg)
             rc = EXIT_FAILURE;
         }
 
+        // Header carries length of the file, so it is known only now
+        if (EXIT_SUCCESS == rc)
+        {
+            hlen = snprintf(NULL, 0, format, type->mime, blen,
+                            type->addition);
+
+            if (0 > hlen)
+            {
+                LOG_M(ERROR, "sprintf error");
+                rc = EXIT_FAILURE;
+            }
+        }
+
+        // Terminating zero of header is written before the file is read
         if (EXIT_SUCCESS == rc)
         {
-            message = malloc(hlen + blen);
+            message = malloc(hlen + blen + 1);
 
             if (!message)
             {
@@ -185,7 +195,8 @@ static int func(const int fd, const request_t *const request, void *arg)
             is_free = 1;
             len = hlen + blen;
 
-            if (0 > sprintf(message, format, type->mime, type->addition))
+            if (0 > sprintf(message, format, type->mime, blen,
+                            type->addition))
             {
                 LOG_M(ERROR, "sprintf error");
                 rc = EXIT_FAILURE;
@@ -204,7 +215,7 @@ static int func(const int fd, const request_t *const request, void *arg)
     }
 
     if (EXIT_SUCCESS == rc)
-        if (len != send(fd, message, len, 0))
+        if (EXIT_SUCCESS != request_send(request, fd, message, len))
         {
             char buf[200];
             strerror_r(errno, buf, 200);
@@ -225,7 +236,7 @@ static void free_wrap(void **const arg)
 
 handler_t file_request_get(file_type_bank_t *const bank)
 {
-    handler_t handler = {check, func, bank, free_wrap};
+    handler_t handler = {check, func, bank, free_wrap, 0};
 
     return handler;
 }
@@ -12,10 +12,12 @@
 
 #include "logger.h"
 
-#define FORM                                                              \
+#define HEADER                                                            \
 "HTTP/1.1 200 OK\r\n"                                                     \
 "Content-Type: text/html; charset=UTF-8\r\n"                              \
-"\r\n"                                                                    \
+"Content-Length: %zd\r\n"                                                 \
+"\r\n"
+#define FORM                                                              \
 "<html>"                                                                  \
     "<head>"                                                              \
         "<title>Static server</title>"                                    \
@@ -175,17 +177,20 @@ static int func(const int fd, const request_t *const request, void *arg)
     if (NULL != dir)
         closedir(dir);
 
-    ssize_t len;
+    ssize_t len, hlen, blen;
 
     if (EXIT_SUCCESS == rc)
     {
-        len = snprintf(NULL, 0, FORM, title->path, list);
+        blen = snprintf(NULL, 0, FORM, title->path, list);
+        hlen = 0 > blen ? blen : snprintf(NULL, 0, HEADER, blen);
 
-        if (0 > len)
+        if (0 > blen || 0 > hlen)
         {
             LOG_M(ERROR, "sprintf error");
             rc = EXIT_FAILURE;
         }
+        else
+            len = hlen + blen;
     }
 
     if (EXIT_SUCCESS == rc)
@@ -199,13 +204,17 @@ static int func(const int fd, const request_t *const request, void *arg)
         }
     }
 
-    if (EXIT_SUCCESS == rc && 0 > snprintf(message, len + 1, FORM, title->path, list))
+    if (EXIT_SUCCESS == rc
+        && (0 > snprintf(message, hlen + 1, HEADER, blen)
+            || 0 > snprintf(message + hlen, blen + 1, FORM, title->path,
+                            list)))
     {
         LOG_M(ERROR, "sprintf error");
         rc = EXIT_FAILURE;
     }
 
-    if (EXIT_SUCCESS == rc && len != send(fd, message, len, 0))
+    if (EXIT_SUCCESS == rc
+        && EXIT_SUCCESS != request_send(request, fd, message, len))
     {
         char buf[200];
         strerror_r(errno, buf, 200);
@@ -221,7 +230,7 @@ static int func(const int fd, const request_t *const request, void *arg)
 
 handler_t index_request_get(void)
 {
-    handler_t handler = {check, func, NULL, NULL};
+    handler_t handler = {check, func, NULL, NULL, 0};
 
     return handler;
 }
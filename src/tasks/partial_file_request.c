@@ -37,9 +37,10 @@ static int check(const request_t *const request)
 }
 
 #define CRLF      "\r\n"
-#define FORMAT    "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n%s"
+#define FORMAT    "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n" \
+                  "Content-Length: %zu\r\n%s"
 #define FRANGE    "Content-Range: bytes %zu-%zu/%zu\r\n"
-#define NOT_FOUND "HTTP/1.1 404 Not Found\r\n\r\n"
+#define NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
 
 static int send_not_found(const int fd)
 {
@@ -57,8 +58,9 @@ static int send_not_found(const int fd)
     return rc;
 }
 
-static int send_file(const int socket, const int file, const file_type_t *type,
-                     const int head)
+// Body is sent at the rate of request limits, as it may take long
+static int send_file(const int socket, const request_t *const request,
+                     const int file, const file_type_t *type, const int head)
 {
     int rc = EXIT_SUCCESS;
     char *buffer = malloc(BUFSIZE);
@@ -70,19 +72,25 @@ static int send_file(const int socket, const int file, const file_type_t *type,
         return EXIT_FAILURE;
     }
 
-    int hlen = sprintf(buffer, FORMAT CRLF, type->mime, type->addition);
+    int hlen = 0;
     struct stat stat;
 
-    if (0 > hlen)
+    if (-1 == fstat(file, &stat))
     {
-        WLOG_M(ERROR, "sprintf error");
+        WLOG_M(ERROR, "fstat error");
         rc = EXIT_FAILURE;
     }
 
-    if (EXIT_SUCCESS == rc && -1 == fstat(file, &stat))
+    if (EXIT_SUCCESS == rc)
     {
-        WLOG_M(ERROR, "sprintf error");
-        rc = EXIT_FAILURE;
+        hlen = sprintf(buffer, FORMAT CRLF, type->mime,
+                       (size_t)stat.st_size, type->addition);
+
+        if (0 > hlen)
+        {
+            WLOG_M(ERROR, "sprintf error");
+            rc = EXIT_FAILURE;
+        }
     }
 
     if (EXIT_SUCCESS == rc && head)
@@ -102,7 +110,8 @@ static int send_file(const int socket, const int file, const file_type_t *type,
         char *bbuf = buffer + hlen;
 
         for (size_t start = 0, end = step;
-             EXIT_SUCCESS == rc && (size_t)stat.st_size > start;
+             EXIT_SUCCESS == rc
+             && (offset || (size_t)stat.st_size > start);
              start = end)
         {
             end = start + step;
@@ -123,7 +132,8 @@ static int send_file(const int socket, const int file, const file_type_t *type,
             ssize_t total = offset + rd;
 
             if (EXIT_SUCCESS == rc
-                && total != send(socket, buffer, total, 0))
+                && EXIT_SUCCESS != request_send(request, socket, buffer,
+                                                total))
             {
                 char buf[200];
                 strerror_r(errno, buf, 200);
@@ -182,7 +192,7 @@ static int func(const int fd, const request_t *const request, void *arg)
     }
     else if (-1 != file)
     {
-        rc = send_file(fd, file, type, head);
+        rc = send_file(fd, request, file, type, head);
         close(file);
     }
     else
@@ -203,7 +213,7 @@ static void free_wrap(void **const arg)
 
 handler_t partial_file_request_get(file_type_bank_t *const bank)
 {
-    handler_t handler = {check, func, bank, free_wrap};
+    handler_t handler = {check, func, bank, free_wrap, 0};
 
     return handler;
 }
@@ -17,7 +17,8 @@ static int func(const int fd, const request_t *const request, void *arg)
     if (0 > fd || NULL == request || NULL != arg)
         return EXIT_FAILURE;
 
-    static const char *const message = "HTTP/1.1 200 OK\r\n\r\n";
+    static const char *const message = "HTTP/1.1 200 OK\r\n"
+                                       "Content-Length: 0\r\n\r\n";
     static ssize_t len = -1;
 
     if (-1 == len)
@@ -41,7 +42,7 @@ static int func(const int fd, const request_t *const request, void *arg)
 
 handler_t print_request_get(void)
 {
-    handler_t handler = {check, func, NULL, NULL};
+    handler_t handler = {check, func, NULL, NULL, 0};
 
     return handler;
 }
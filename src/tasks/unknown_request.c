@@ -34,7 +34,8 @@ static int func(const int fd, const request_t *const request, void *arg)
         LOG_F(WARNING, "Unimplemented request: %s %s %s", title->method,
               title->path, title->version);
 
-    static const char *const message = "HTTP/1.1 405 Method Not Allowed\r\n\r\n";
+    static const char *const message = "HTTP/1.1 405 Method Not Allowed\r\n"
+                                         "Content-Length: 0\r\n\r\n";
     static ssize_t len = -1;
 
     if (-1 == len)
@@ -42,7 +43,7 @@ static int func(const int fd, const request_t *const request, void *arg)
 
     int rc = EXIT_SUCCESS;
 
-    if (len != send(fd, message, len, 0))
+    if (len != send(fd, message, len, MSG_DONTWAIT))
     {
         char buf[200];
         strerror_r(errno, buf, 200);
@@ -55,7 +56,7 @@ static int func(const int fd, const request_t *const request, void *arg)
 
 handler_t unknown_request_get(void)
 {
-    handler_t handler = {check, func, NULL, NULL};
+    handler_t handler = {check, func, NULL, NULL, 0};
 
     return handler;
 }
@@ -0,0 +1,281 @@
+#define _POSIX_C_SOURCE 200112L
+#define _GNU_SOURCE
+#include "timer_wheel.h"
+
+#include <stdint.h>
+#include <time.h>
+
+// Ticks are milliseconds. Four levels of 64 slots cover about 4.6 hours,
+// longer timeouts are clamped to the widest level.
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE  ((size_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+typedef struct
+{
+    timer_wheel_entry_t *slots[WHEEL_SLOTS];
+    uint64_t occupied;
+} timer_wheel_level_t;
+
+struct _timer_wheel
+{
+    size_t current;
+    size_t armed;
+    timer_wheel_level_t levels[WHEEL_LEVELS];
+};
+
+static void timer_wheel_link(timer_wheel_t *const wheel,
+                             timer_wheel_entry_t *const entry);
+static void timer_wheel_unlink(timer_wheel_t *const wheel,
+                               timer_wheel_entry_t *const entry);
+static void timer_wheel_cascade(timer_wheel_t *const wheel, const size_t level);
+
+size_t timer_wheel_clock(void)
+{
+    struct timespec now;
+
+    if (-1 == clock_gettime(CLOCK_MONOTONIC_COARSE, &now))
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (size_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+timer_wheel_t *timer_wheel_init(void)
+{
+    timer_wheel_t *wheel = calloc(1, sizeof(timer_wheel_t));
+
+    if (NULL == wheel)
+        return errno = ERROR_TIMER_WHEEL_ALLOCATION, NULL;
+
+    wheel->current = timer_wheel_clock();
+
+    return wheel;
+}
+
+void timer_wheel_entry_init(timer_wheel_entry_t *const entry)
+{
+    if (NULL == entry)
+        return;
+
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->expire = 0;
+    entry->slot = 0;
+    entry->armed = 0;
+}
+
+int timer_wheel_arm(timer_wheel_t *const wheel,
+                    timer_wheel_entry_t *const entry, const size_t timeout)
+{
+    if (NULL == wheel || NULL == entry)
+        return ERROR_TIMER_WHEEL_NULL;
+
+    if (entry->armed)
+        return ERROR_TIMER_WHEEL_ARMED;
+
+    size_t expire = timer_wheel_clock() + timeout;
+
+    if (expire < wheel->current)
+        expire = wheel->current;
+
+    if (expire - wheel->current >= WHEEL_RANGE)
+        expire = wheel->current + WHEEL_RANGE - 1;
+
+    entry->expire = expire;
+    entry->armed = 1;
+    wheel->armed++;
+    timer_wheel_link(wheel, entry);
+
+    return EXIT_SUCCESS;
+}
+
+int timer_wheel_cancel(timer_wheel_t *const wheel,
+                       timer_wheel_entry_t *const entry)
+{
+    if (NULL == wheel || NULL == entry)
+        return ERROR_TIMER_WHEEL_NULL;
+
+    if (!entry->armed)
+        return EXIT_SUCCESS;
+
+    timer_wheel_unlink(wheel, entry);
+    entry->armed = 0;
+    wheel->armed--;
+
+    return EXIT_SUCCESS;
+}
+
+int timer_wheel_expire(timer_wheel_t *const wheel,
+                       const timer_wheel_handler_t *const handler)
+{
+    if (NULL == wheel || NULL == handler || NULL == handler->func)
+        return ERROR_TIMER_WHEEL_NULL;
+
+    size_t now = timer_wheel_clock();
+    int stop = 0;
+
+    while (!stop && wheel->current <= now)
+    {
+        size_t index = wheel->current & WHEEL_MASK;
+
+        if (0 == index)
+            timer_wheel_cascade(wheel, 1);
+
+        timer_wheel_level_t *level = wheel->levels;
+
+        while (!stop && NULL != level->slots[index])
+        {
+            timer_wheel_entry_t *entry = level->slots[index];
+
+            timer_wheel_unlink(wheel, entry);
+            entry->armed = 0;
+            wheel->armed--;
+
+            // Refused entry goes back to the same slot, which will be
+            // visited first next time
+            if (EXIT_SUCCESS != handler->func(handler->arg, entry))
+            {
+                timer_wheel_link(wheel, entry);
+                entry->armed = 1;
+                wheel->armed++;
+                stop = 1;
+            }
+        }
+
+        // Empty slots are skipped up to next occupied one or cascade point
+        uint64_t rest = level->occupied >> index;
+        size_t step = WHEEL_SLOTS - index;
+
+        if (0 != (rest & ~(uint64_t)1))
+            step = __builtin_ctzll(rest & ~(uint64_t)1);
+
+        if (wheel->current + step > now + 1)
+            step = now + 1 - wheel->current;
+
+        if (!stop)
+            wheel->current += step;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Entries of higher levels are due no earlier, than their slot is cascaded
+// at its start, so the nearest occupied slot of every level is taken. Slot of
+// the current block is still ahead, only when its cascade is pending.
+size_t timer_wheel_next(const timer_wheel_t *const wheel)
+{
+    if (NULL == wheel || 0 == wheel->armed)
+        return TIMER_WHEEL_NONE;
+
+    size_t at = TIMER_WHEEL_NONE;
+
+    for (size_t level = 0; WHEEL_LEVELS > level; level++)
+    {
+        uint64_t occupied = wheel->levels[level].occupied;
+        size_t shift = WHEEL_BITS * level;
+        size_t block = wheel->current >> shift;
+
+        if (0 == occupied)
+            continue;
+
+        if (0 != (wheel->current & (((size_t)1 << shift) - 1)))
+            block++;
+
+        // Slots are rotated, so that the first one belongs to block
+        size_t index = block & WHEEL_MASK;
+        uint64_t rest = occupied >> index;
+
+        if (0 != index)
+            rest |= occupied << (WHEEL_SLOTS - index);
+
+        size_t start = (block + __builtin_ctzll(rest)) << shift;
+
+        if (start < at)
+            at = start;
+    }
+
+    size_t now = timer_wheel_clock();
+
+    return at > now ? at - now : 0;
+}
+
+void timer_wheel_free(timer_wheel_t **const wheel)
+{
+    if (NULL == wheel || NULL == *wheel)
+        return;
+
+    free(*wheel);
+    *wheel = NULL;
+}
+
+static void timer_wheel_link(timer_wheel_t *const wheel,
+                             timer_wheel_entry_t *const entry)
+{
+    size_t delta = entry->expire - wheel->current;
+    size_t level = 0;
+
+    for (; WHEEL_LEVELS - 1 > level
+           && delta >= (size_t)1 << (WHEEL_BITS * (level + 1)); level++);
+
+    size_t index = (entry->expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer_wheel_level_t *current = wheel->levels + level;
+
+    entry->slot = level * WHEEL_SLOTS + index;
+    entry->prev = NULL;
+    entry->next = current->slots[index];
+
+    if (NULL != entry->next)
+        entry->next->prev = entry;
+
+    current->slots[index] = entry;
+    current->occupied |= (uint64_t)1 << index;
+}
+
+static void timer_wheel_unlink(timer_wheel_t *const wheel,
+                               timer_wheel_entry_t *const entry)
+{
+    size_t index = entry->slot & WHEEL_MASK;
+    timer_wheel_level_t *current = wheel->levels + entry->slot / WHEEL_SLOTS;
+
+    if (NULL != entry->prev)
+        entry->prev->next = entry->next;
+    else
+        current->slots[index] = entry->next;
+
+    if (NULL != entry->next)
+        entry->next->prev = entry->prev;
+
+    if (NULL == current->slots[index])
+        current->occupied &= ~((uint64_t)1 << index);
+
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static void timer_wheel_cascade(timer_wheel_t *const wheel, const size_t level)
+{
+    if (WHEEL_LEVELS <= level)
+        return;
+
+    size_t index = (wheel->current >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    if (0 == index)
+        timer_wheel_cascade(wheel, level + 1);
+
+    timer_wheel_level_t *current = wheel->levels + level;
+    timer_wheel_entry_t *entry = current->slots[index];
+
+    current->slots[index] = NULL;
+    current->occupied &= ~((uint64_t)1 << index);
+
+    // Entries are spread over lower levels according to time left
+    while (NULL != entry)
+    {
+        timer_wheel_entry_t *next = entry->next;
+
+        timer_wheel_link(wheel, entry);
+        entry = next;
+    }
+}
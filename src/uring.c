@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+
+typedef struct
+{
+    unsigned *head;
+    unsigned *tail;
+    unsigned mask;
+    unsigned *array;
+    unsigned local;
+    unsigned submitted;
+    struct io_uring_sqe *sqes;
+} uring_sq_t;
+
+typedef struct
+{
+    unsigned *head;
+    unsigned *tail;
+    unsigned mask;
+    struct io_uring_cqe *cqes;
+} uring_cq_t;
+
+struct _uring
+{
+    int fd;
+    unsigned entries;
+    void *ring;
+    size_t ring_size;
+    void *sqes;
+    size_t sqes_size;
+    uring_sq_t sq;
+    uring_cq_t cq;
+
+    struct io_uring_buf_ring *buffers;
+    size_t buffers_size;
+    char *data;
+    size_t data_size;
+    unsigned buffer_count;
+    size_t buffer_size;
+};
+
+static int uring_setup(const unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(const int fd, const unsigned submit, const unsigned wait,
+                       const unsigned flags, const void *const arg,
+                       const size_t size)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+}
+
+static int uring_register(const int fd, const unsigned opcode,
+                          const void *const arg, const unsigned count)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static int uring_map(uring_t *const ring, const struct io_uring_params *params)
+{
+    size_t sq_size = params->sq_off.array
+                     + params->sq_entries * sizeof(unsigned);
+    size_t cq_size = params->cq_off.cqes
+                     + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    // Both rings share a single mapping, which is guaranteed by
+    // IORING_FEAT_SINGLE_MMAP checked during init
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if (MAP_FAILED == ring->ring)
+    {
+        ring->ring = NULL;
+
+        return ERROR_URING_MAP;
+    }
+
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (MAP_FAILED == ring->sqes)
+    {
+        ring->sqes = NULL;
+
+        return ERROR_URING_MAP;
+    }
+
+    char *base = ring->ring;
+
+    ring->sq.head = (unsigned *)(base + params->sq_off.head);
+    ring->sq.tail = (unsigned *)(base + params->sq_off.tail);
+    ring->sq.mask = *(unsigned *)(base + params->sq_off.ring_mask);
+    ring->sq.array = (unsigned *)(base + params->sq_off.array);
+    ring->sq.local = *ring->sq.tail;
+    ring->sq.submitted = ring->sq.local;
+    ring->sq.sqes = ring->sqes;
+
+    ring->cq.head = (unsigned *)(base + params->cq_off.head);
+    ring->cq.tail = (unsigned *)(base + params->cq_off.tail);
+    ring->cq.mask = *(unsigned *)(base + params->cq_off.ring_mask);
+    ring->cq.cqes = (struct io_uring_cqe *)(base + params->cq_off.cqes);
+
+    return EXIT_SUCCESS;
+}
+
+uring_t *uring_init(const unsigned entries)
+{
+    if (0 == entries)
+        return errno = ERROR_URING_INVALID, NULL;
+
+    uring_t *ring = malloc(sizeof(uring_t));
+
+    if (NULL == ring)
+        return errno = ERROR_URING_ALLOCATION, NULL;
+
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+    ring->entries = entries;
+
+    int rc = EXIT_SUCCESS;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Completion queue is made larger, so bursts of multishot completions
+    // don't overflow it between two reaps
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER
+                   | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    ring->fd = uring_setup(entries, &params);
+
+    if (-1 == ring->fd && EINVAL == errno)
+    {
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        ring->fd = uring_setup(entries, &params);
+    }
+
+    if (-1 == ring->fd)
+        rc = ERROR_URING_SETUP;
+
+    if (EXIT_SUCCESS == rc
+        && (!(IORING_FEAT_SINGLE_MMAP & params.features)
+            || !(IORING_FEAT_EXT_ARG & params.features)))
+        rc = ERROR_URING_UNSUPPORTED;
+
+    if (EXIT_SUCCESS == rc)
+        rc = uring_map(ring, &params);
+
+    if (EXIT_SUCCESS != rc)
+    {
+        uring_free(&ring);
+
+        return errno = rc, NULL;
+    }
+
+    return ring;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *const ring)
+{
+    if (NULL == ring)
+        return errno = ERROR_URING_NULL, NULL;
+
+    unsigned head = __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE);
+
+    // Queue is flushed to the kernel, when no free entries left
+    if (ring->sq.local - head > ring->sq.mask
+        && EXIT_SUCCESS == uring_submit(ring, 0, 0))
+        head = __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq.local - head > ring->sq.mask)
+        return errno = ERROR_URING_FULL, NULL;
+
+    unsigned index = ring->sq.local & ring->sq.mask;
+    struct io_uring_sqe *sqe = ring->sq.sqes + index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq.array[index] = index;
+    ring->sq.local++;
+
+    return sqe;
+}
+
+int uring_submit(uring_t *const ring, const unsigned wait,
+                 const size_t timeout)
+{
+    if (NULL == ring)
+        return ERROR_URING_NULL;
+
+    unsigned submit = ring->sq.local - ring->sq.submitted;
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    const void *parg = NULL;
+    size_t size = 0;
+
+    __atomic_store_n(ring->sq.tail, ring->sq.local, __ATOMIC_RELEASE);
+
+    if (wait)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    if (wait && timeout)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (unsigned long)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        parg = &arg;
+        size = sizeof(arg);
+    }
+
+    if (0 == submit && 0 == wait)
+        return EXIT_SUCCESS;
+
+    int res = uring_enter(ring->fd, submit, wait, flags, parg, size);
+
+    if (-1 == res)
+    {
+        // Timeout and signal are ordinary ways to leave the wait
+        if (ETIME == errno || EINTR == errno)
+            return EXIT_SUCCESS;
+
+        return ERROR_URING_ENTER;
+    }
+
+    ring->sq.submitted += res;
+
+    return EXIT_SUCCESS;
+}
+
+struct io_uring_cqe *uring_cqe(uring_t *const ring)
+{
+    if (NULL == ring)
+        return errno = ERROR_URING_NULL, NULL;
+
+    unsigned head = *ring->cq.head;
+
+    if (head == __atomic_load_n(ring->cq.tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return ring->cq.cqes + (head & ring->cq.mask);
+}
+
+void uring_cqe_seen(uring_t *const ring)
+{
+    if (NULL == ring)
+        return;
+
+    __atomic_store_n(ring->cq.head, *ring->cq.head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_buffers_init(uring_t *const ring, const unsigned count,
+                       const size_t size)
+{
+    if (NULL == ring)
+        return ERROR_URING_NULL;
+
+    // Ring size must be a power of 2
+    if (0 == count || 0 != (count & (count - 1)) || 0 == size
+        || 32768 < count || NULL != ring->buffers)
+        return ERROR_URING_INVALID;
+
+    int rc = EXIT_SUCCESS;
+
+    ring->buffers_size = count * sizeof(struct io_uring_buf);
+    ring->buffers = mmap(NULL, ring->buffers_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == ring->buffers)
+    {
+        ring->buffers = NULL;
+        rc = ERROR_URING_ALLOCATION;
+    }
+
+    if (EXIT_SUCCESS == rc)
+    {
+        ring->data_size = count * size;
+        ring->data = malloc(ring->data_size);
+
+        if (NULL == ring->data)
+            rc = ERROR_URING_ALLOCATION;
+    }
+
+    if (EXIT_SUCCESS == rc)
+    {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (unsigned long)ring->buffers;
+        reg.ring_entries = count;
+        reg.bgid = URING_BUFFER_GROUP;
+
+        if (-1 == uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+            rc = ERROR_URING_REGISTER;
+    }
+
+    if (EXIT_SUCCESS != rc)
+    {
+        if (NULL != ring->buffers)
+            munmap(ring->buffers, ring->buffers_size);
+
+        free(ring->data);
+        ring->buffers = NULL;
+        ring->data = NULL;
+
+        return rc;
+    }
+
+    ring->buffer_count = count;
+    ring->buffer_size = size;
+    ring->buffers->tail = 0;
+
+    for (unsigned i = 0; count > i; i++)
+        uring_buffer_recycle(ring, i);
+
+    return rc;
+}
+
+const char *uring_buffer(const uring_t *const ring, const unsigned id)
+{
+    if (NULL == ring || NULL == ring->data || ring->buffer_count <= id)
+        return NULL;
+
+    return ring->data + id * ring->buffer_size;
+}
+
+void uring_buffer_recycle(uring_t *const ring, const unsigned id)
+{
+    if (NULL == ring || NULL == ring->buffers || ring->buffer_count <= id)
+        return;
+
+    unsigned short tail = ring->buffers->tail;
+    struct io_uring_buf *buffer = ring->buffers->bufs
+                                  + (tail & (ring->buffer_count - 1));
+
+    buffer->addr = (unsigned long)(ring->data + id * ring->buffer_size);
+    buffer->len = ring->buffer_size;
+    buffer->bid = id;
+
+    __atomic_store_n(&ring->buffers->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void uring_free(uring_t **const ring)
+{
+    if (NULL == ring || NULL == *ring)
+        return;
+
+    if (NULL != (*ring)->buffers)
+        munmap((*ring)->buffers, (*ring)->buffers_size);
+
+    if (NULL != (*ring)->sqes)
+        munmap((*ring)->sqes, (*ring)->sqes_size);
+
+    if (NULL != (*ring)->ring)
+        munmap((*ring)->ring, (*ring)->ring_size);
+
+    if (-1 != (*ring)->fd)
+        close((*ring)->fd);
+
+    free((*ring)->data);
+    free(*ring);
+    *ring = NULL;
+}
@@ -2,9 +2,13 @@
 #include "worker.h"
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "logger.h"
 #include "request_parser.h"
@@ -14,6 +18,10 @@
 
 #define INITIAL_SIZE 4096
 
+// Worker on CPU of connection is preferred, while its queue is at most this
+// much longer than the shortest one
+#define STEER_SLACK 4
+
 struct _worker
 {
     int pipe[2];
@@ -25,6 +33,13 @@ struct _worker
     handler_list_t *head;
     worker_callback_t callback;
     worker_error_t ecallback;
+    worker_admission_t admission;
+    request_limits_t limits;
+    size_t above;
+    int overloaded;
+    int retired;
+    int finished;
+    int cpu;
 };
 
 size_t worker_size(void)
@@ -32,13 +47,33 @@ size_t worker_size(void)
     return sizeof(struct _worker);
 }
 
+// Queue delay is measured with ms precision, coarse clock is too rough for
+// targets of several ms
+static size_t worker_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (size_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void worker_admission_reset(worker_t *worker)
+{
+    worker->above = 0;
+    __atomic_store_n(&worker->overloaded, 0, __ATOMIC_RELAXED);
+}
+
 int worker_init(worker_t *worker, handler_list_t *handlers,
-                worker_callback_t *callback, worker_error_t *error)
+                worker_callback_t *callback, worker_error_t *error,
+                const worker_admission_t *const admission,
+                const request_limits_t *const limits, const int cpu)
 {
     if (NULL == worker || NULL == handlers || NULL == callback
         || NULL == callback->func)
         return ERROR_WORKER_NULL;
 
+    worker->cpu = cpu;
     worker->alive = 1;
     worker->error = 0;
     worker->head = handlers;
@@ -46,7 +81,20 @@ int worker_init(worker_t *worker, handler_list_t *handlers,
     worker->pipe[0] = 0;
     worker->pipe[1] = 0;
     worker->queue = 0;
+    worker->retired = 0;
+    worker->finished = 0;
     worker->callback = *callback;
+    worker_admission_reset(worker);
+
+    if (admission)
+        worker->admission = *admission;
+    else
+        memset(&worker->admission, 0, sizeof(worker_admission_t));
+
+    if (limits)
+        worker->limits = *limits;
+    else
+        memset(&worker->limits, 0, sizeof(request_limits_t));
 
     if (error)
         worker->ecallback = *error;
@@ -109,10 +157,17 @@ int worker_error(worker_t *worker)
 
 int worker_request(worker_t *worker, const int fd)
 {
-    if (NULL == worker || 0 == fd)
+    worker_task_t task = {fd, NULL, 0, 0, NULL, NULL};
+
+    return worker_request_task(worker, &task);
+}
+
+int worker_request_task(worker_t *worker, const worker_task_t *const task)
+{
+    if (NULL == worker || NULL == task || 0 == task->fd)
         return ERROR_WORKER_NULL;
 
-    LOG_F(INFO, "Request in %d", fd);
+    LOG_F(INFO, "Request in %d", task->fd);
 
     int rc = pthread_mutex_lock(&worker->mutex);
 
@@ -137,9 +192,14 @@ int worker_request(worker_t *worker, const int fd)
 
     if (EXIT_SUCCESS == rc)
     {
-        ssize_t size = write(worker->pipe[1], &fd, sizeof(int));
+        worker_task_t queued = *task;
+
+        queued.stamp = worker_clock();
+
+        // Task is smaller than PIPE_BUF, so write is atomic
+        ssize_t size = write(worker->pipe[1], &queued, sizeof(worker_task_t));
 
-        if (sizeof(int) != size)
+        if (sizeof(worker_task_t) != size)
         {
             LOG_M(ERROR, "Error during request write");
             rc = ERROR_WORKER_UNABLE_TO_WRITE;
@@ -163,8 +223,26 @@ int worker_request(worker_t *worker, const int fd)
 
 int worker_request_dispatch(worker_t *worker, const size_t size, const int fd)
 {
+    worker_task_t task = {fd, NULL, 0, 0, NULL, NULL};
+
+    return worker_request_dispatch_task(worker, size, &task);
+}
+
+int worker_request_dispatch_task(worker_t *worker, const size_t size,
+                                 const worker_task_t *const task)
+{
+    return worker_request_dispatch_cpu(worker, size, task, -1);
+}
+
+int worker_request_dispatch_cpu(worker_t *worker, const size_t size,
+                                const worker_task_t *const task,
+                                const int cpu)
+{
+    if (NULL == task)
+        return ERROR_WORKER_NULL;
+
     int rc = EXIT_SUCCESS;
-    worker_t *chosen = NULL;
+    worker_t *chosen = NULL, *local = NULL;
 
     for (size_t i = 0; EXIT_SUCCESS == rc && size > i; i++)
     {
@@ -179,6 +257,10 @@ int worker_request_dispatch(worker_t *worker, const size_t size, const int fd)
             && (!chosen || chosen->queue > current->queue))
             chosen = current;
 
+        if (EXIT_SUCCESS == rc && current->alive && -1 != cpu
+            && cpu == current->cpu && (!local || local->queue > current->queue))
+            local = current;
+
         if (EXIT_SUCCESS == rc)
         {
             rc = pthread_mutex_unlock(&current->mutex);
@@ -188,9 +270,18 @@ int worker_request_dispatch(worker_t *worker, const size_t size, const int fd)
         }
     }
 
-    if (EXIT_SUCCESS == rc && chosen)
+    if (EXIT_SUCCESS == rc && local
+        && local->queue <= chosen->queue + STEER_SLACK)
+        chosen = local;
+
+    // Even the least loaded worker has been late for a while, so new task
+    // would only add to delay of queued ones
+    if (EXIT_SUCCESS == rc && chosen
+        && __atomic_load_n(&chosen->overloaded, __ATOMIC_RELAXED))
+        rc = ERROR_WORKER_OVERLOAD;
+    else if (EXIT_SUCCESS == rc && chosen)
     {
-        rc = worker_request(chosen, fd);
+        rc = worker_request_task(chosen, task);
 
         if (ERROR_WORKER_NOT_ALIVE == rc || ERROR_WORKER_ACTIVE == rc)
         {
@@ -214,22 +305,24 @@ int worker_wake_up(worker_t *worker, const size_t size)
         worker_t *current = worker + i;
         int mrc = pthread_mutex_lock(&current->mutex);
 
-        if (EXIT_SUCCESS == mrc && !worker->alive)
+        if (EXIT_SUCCESS == mrc && !current->alive)
         {
-            LOG_F(INFO, "Worker %zu[%d] down", i, worker->thread);
+            LOG_F(INFO, "Worker %zu[%d] down", i, current->thread);
 
-            worker->queue = 0;
-            worker->alive = 1;
-            worker->error = 0;
-            worker->thread = 0;
+            current->queue = 0;
+            current->alive = 1;
+            current->error = 0;
+            current->thread = 0;
+            current->finished = 0;
+            worker_admission_reset(current);
 
-            rc = pthread_create(&worker->thread, NULL, worker_main, worker);
+            rc = pthread_create(&current->thread, NULL, worker_main, current);
 
             if (EXIT_SUCCESS == rc)
-                LOG_F(INFO, "Worker %zu[%d] wake up attempt success", i, worker->thread);
+                LOG_F(INFO, "Worker %zu[%d] wake up attempt success", i, current->thread);
             else
             {
-                LOG_F(INFO, "Worker %zu[%d] wake up attempt fail", i, worker->thread);
+                LOG_F(INFO, "Worker %zu[%d] wake up attempt fail", i, current->thread);
                 rc = ERROR_WORKER_THREAD_INIT;
             }
         }
@@ -249,6 +342,171 @@ int worker_wake_up(worker_t *worker, const size_t size)
     return rc;
 }
 
+// Decides under worker mutex, whether dequeued task is shed. Delay above
+// target is tolerated for one interval as a burst, after that queue is
+// standing: every task late for more than target is shed, until queue has
+// drained to tasks on time.
+static int worker_admit(worker_t *worker, const worker_task_t *const task)
+{
+    const worker_admission_t *admission = &worker->admission;
+    size_t now = worker_clock();
+    size_t sojourn = now > task->stamp ? now - task->stamp : 0;
+    int shed = admission->deadline && admission->deadline <= sojourn;
+
+    if (0 == admission->target)
+        return shed;
+
+    if (admission->target > sojourn || 1 >= worker->queue)
+        worker_admission_reset(worker);
+    else if (0 == worker->above)
+        worker->above = now;
+    else if (admission->interval <= now - worker->above)
+    {
+        __atomic_store_n(&worker->overloaded, 1, __ATOMIC_RELAXED);
+        shed = 1;
+    }
+
+    return shed;
+}
+
+// Responses are held in socket, while more of them are going to follow
+static int worker_cork(const int fd, const int on)
+{
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+int worker_serve(handler_list_t *handlers, request_t *request,
+                 handler_call_t *call, const worker_task_t *const task,
+                 int *const keep, int *const error)
+{
+    if (NULL == handlers || NULL == request || NULL == call || NULL == task
+        || NULL == keep || NULL == error)
+        return ERROR_WORKER_NULL;
+
+    int rc = EXIT_SUCCESS, corked = 0;
+
+    *keep = 0;
+    request_reset(request);
+
+    if (NULL != task->data
+        && EXIT_SUCCESS != request_append(request, task->data, task->size))
+    {
+        *error = WORKER_ERROR_ALLOCAION;
+        rc = EXIT_FAILURE;
+    }
+
+    // Pipelined requests are answered in order, until nothing is left
+    for (int next = EXIT_SUCCESS == rc, first = 1; next; first = 0)
+    {
+        int limited = !first && NULL != task->limiter
+                      && EXIT_SUCCESS != limiter_take(task->limiter, task->fd);
+
+        rc = limited ? EXIT_FAILURE : request_read_exist(request, task->fd);
+
+        if (limited)
+        {
+            WLOG_F(INFO, "Socket %d: client is over request rate", task->fd);
+            *error = WORKER_ERROR_LIMITED;
+        }
+        else if (EXIT_SUCCESS != rc && request_closed(request))
+        {
+            WLOG_F(INFO, "Socket %d: closed by peer", task->fd);
+            rc = EXIT_SUCCESS;
+            next = 0;
+        }
+        else if (EXIT_SUCCESS != rc && request_expired(request))
+        {
+            WLOG_F(WARNING, "Socket %d: request isn't received in time",
+                   task->fd);
+            *error = WORKER_ERROR_TIMEOUT;
+            rc = EXIT_FAILURE;
+        }
+        else if (EXIT_SUCCESS != rc && request_too_long(request))
+        {
+            WLOG_F(WARNING, "Socket %d: request line is too long", task->fd);
+            *error = WORKER_ERROR_LONG_LINE;
+            rc = EXIT_FAILURE;
+        }
+        else if (EXIT_SUCCESS != rc && request_too_large(request))
+        {
+            WLOG_F(WARNING, "Socket %d: request header is too large",
+                   task->fd);
+            *error = WORKER_ERROR_LARGE_HEADER;
+            rc = EXIT_FAILURE;
+        }
+        else if (EXIT_SUCCESS != rc && request_body_too_large(request))
+        {
+            WLOG_F(WARNING, "Socket %d: request body is too large", task->fd);
+            *error = WORKER_ERROR_LARGE_BODY;
+            rc = EXIT_FAILURE;
+        }
+        else if (EXIT_SUCCESS != rc && request_malformed(request))
+        {
+            WLOG_F(WARNING, "Socket %d: request can't be framed", task->fd);
+            *error = WORKER_ERROR_BAD_REQUEST;
+            rc = EXIT_FAILURE;
+        }
+        else if (EXIT_SUCCESS != rc)
+        {
+            *error = WORKER_ERROR_WRONG_READ;
+            rc = EXIT_FAILURE;
+        }
+
+        if (EXIT_SUCCESS == rc && next)
+        {
+            rc = handler_list_find(handlers, request, call);
+
+            if (ERROR_HANDLER_LIST_NOT_FOUND == rc)
+            {
+                WLOG_M(WARNING, "Request can't be satisfied");
+                const request_title_t *title = request_title(request);
+
+                if (title)
+                    WLOG_F(DEBUG, "Request: %s %s %s", title->method,
+                           title->path, title->version);
+
+                *error = WORKER_ERROR_WRONG_ACTION;
+                rc = EXIT_FAILURE;
+            }
+            else if (EXIT_SUCCESS != rc)
+            {
+                WLOG_M(WARNING, "Request error");
+                *error = WORKER_ERROR_INVALID_ACTION;
+            }
+            else if (EXIT_SUCCESS != (rc = handler_call(call, task->fd,
+                                                        request))
+                     && request_slow(request))
+            {
+                WLOG_F(WARNING, "Socket %d: response isn't taken in time",
+                       task->fd);
+                *error = WORKER_ERROR_SLOW;
+            }
+            else if (EXIT_SUCCESS != rc)
+            {
+                WLOG_M(WARNING, "Error during request");
+                *error = WORKER_ERROR_IN_ACTION;
+            }
+        }
+
+        if (EXIT_SUCCESS == rc && next)
+            *keep = request_keep_alive(request);
+
+        next = EXIT_SUCCESS == rc && next && *keep
+               && 0 != request_pending(request);
+
+        if (next && !corked)
+            corked = EXIT_SUCCESS == worker_cork(task->fd, 1);
+    }
+
+    if (corked)
+        worker_cork(task->fd, 0);
+
+    if (EXIT_SUCCESS != rc)
+        *keep = 0;
+
+    return rc;
+}
+
 void *worker_main(void *arg)
 {
     if (NULL == arg)
@@ -257,11 +515,26 @@ void *worker_main(void *arg)
     WLOG_M(INFO, "Worker start");
 
     worker_t *worker = arg;
+
+    if (-1 != worker->cpu)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+
+        if (EXIT_SUCCESS != pthread_setaffinity_np(pthread_self(),
+                                                   sizeof(set), &set))
+            WLOG_F(WARNING, "Unable to pin worker to CPU %d", worker->cpu);
+    }
+
     request_t *request = request_blank(INITIAL_SIZE);
     handler_call_t *call = handler_call_init();
-    int fd = -1;
+    worker_task_t task = {-1, NULL, 0, 0, NULL, NULL};
+    int fd = -1, stopped = 0, keep = 0;
 
-    if (NULL == request || NULL == call)
+    if (NULL == request || NULL == call
+        || EXIT_SUCCESS != request_set_limits(request, &worker->limits))
     {
         WLOG_M(ERROR, "Worker allocation error, down");
         request_free(&request);
@@ -274,11 +547,12 @@ void *worker_main(void *arg)
     for (int rc = EXIT_SUCCESS, rclock = EXIT_SUCCESS, crc = EXIT_SUCCESS;
          worker->alive;)
     {
-        ssize_t size = read(worker->pipe[0], &fd, sizeof(int));
+        ssize_t size = read(worker->pipe[0], &task, sizeof(worker_task_t));
+        fd = task.fd;
 
         WLOG_F(INFO, "New request: %d", fd);
 
-        if (EXIT_SUCCESS == rc && sizeof(int) != size)
+        if (EXIT_SUCCESS == rc && sizeof(worker_task_t) != size)
         {
             if (-1 == size)
             {
@@ -292,57 +566,45 @@ void *worker_main(void *arg)
             }
 
             fd = -1;
+            task.data = NULL;
             rc = EXIT_FAILURE;
         }
         else if (EXIT_SUCCESS == rc && -1 == fd)
         {
             WLOG_M(INFO, "Exit signal caught");
+            stopped = 1;
             rc = EXIT_FAILURE;
         }
-
-        if (EXIT_SUCCESS == rc && EXIT_SUCCESS == rclock)
+        else if (EXIT_SUCCESS == rc && EXIT_SUCCESS == rclock)
         {
-            rc = request_read_exist(request, fd);
+            rclock = pthread_mutex_lock(&worker->mutex);
 
-            if (EXIT_SUCCESS != rc)
+            if (EXIT_SUCCESS == rclock)
             {
-                worker->error = WORKER_ERROR_WRONG_READ;
-                rc = EXIT_FAILURE;
+                if (worker_admit(worker, &task))
+                {
+                    WLOG_F(INFO, "Socket %d: shed after queue delay", fd);
+                    worker->error = WORKER_ERROR_OVERLOAD;
+                    rc = EXIT_FAILURE;
+                }
+
+                rclock = pthread_mutex_unlock(&worker->mutex);
             }
         }
 
-        if (EXIT_SUCCESS == rc && EXIT_SUCCESS == rclock)
-        {
-            rc = handler_list_find(worker->head, request, call);
-
-            if (ERROR_HANDLER_LIST_NOT_FOUND == rc)
-            {
-                WLOG_M(WARNING, "Request can't be satisfied");
-                const request_title_t *title = request_title(request);
+        keep = 0;
 
-                if (title)
-                    WLOG_F(DEBUG, "Request: %s %s %s", title->method,
-                           title->path, title->version);
+        if (EXIT_SUCCESS == rc && EXIT_SUCCESS == rclock)
+            rc = worker_serve(task.handlers ? task.handlers : worker->head,
+                              request, call, &task, &keep, &worker->error);
 
-                worker->error = WORKER_ERROR_WRONG_ACTION;
-                rc = EXIT_FAILURE;
-            }
-            else if (EXIT_SUCCESS != rc)
-            {
-                WLOG_M(WARNING, "Request error");
-                worker->error = WORKER_ERROR_INVALID_ACTION;
-            }
-            else if (EXIT_SUCCESS != (rc = handler_call(call, fd, request)))
-            {
-                WLOG_M(WARNING, "Error during request");
-                worker->error = WORKER_ERROR_IN_ACTION;
-            }
-        }
+        free(task.data);
+        task.data = NULL;
 
         if (EXIT_SUCCESS != rc && -1 != fd && worker->ecallback.func)
             worker->ecallback.func(worker->ecallback.arg, fd, worker->error);
 
-        crc = worker->callback.func(worker->callback.arg, fd);
+        crc = worker->callback.func(worker->callback.arg, fd, keep);
 
         if (EXIT_SUCCESS != crc)
         {
@@ -389,9 +651,43 @@ void *worker_main(void *arg)
     request_free(&request);
     handler_call_free(&call);
 
+    // Owner is told about unexpected exit with socket -1, as well as about
+    // exit, that it hasn't waited for
+    __atomic_store_n(&worker->finished, 1, __ATOMIC_RELEASE);
+
+    if ((!stopped || __atomic_load_n(&worker->retired, __ATOMIC_ACQUIRE))
+        && worker->ecallback.func)
+        worker->ecallback.func(worker->ecallback.arg, -1, worker->error);
+
     pthread_exit(worker);
 }
 
+int worker_stop(worker_t *worker)
+{
+    if (NULL == worker)
+        return ERROR_WORKER_NULL;
+
+    if (0 == worker->thread)
+        return EXIT_SUCCESS;
+
+    worker_task_t task = {-1, NULL, 0, 0, NULL, NULL};
+
+    __atomic_store_n(&worker->retired, 1, __ATOMIC_RELEASE);
+
+    return sizeof(worker_task_t) == write(worker->pipe[1], &task,
+                                          sizeof(worker_task_t))
+           ? EXIT_SUCCESS : ERROR_WORKER_UNABLE_TO_WRITE;
+}
+
+int worker_is_finished(worker_t *worker)
+{
+    if (NULL == worker)
+        return 0;
+
+    return 0 == worker->thread
+           || __atomic_load_n(&worker->finished, __ATOMIC_ACQUIRE);
+}
+
 void worker_destroy(worker_t *worker)
 {
     if (NULL == worker)
@@ -399,8 +695,8 @@ void worker_destroy(worker_t *worker)
 
     if (0 != worker->thread)
     {
-        int fd = -1;
-        ssize_t size = write(worker->pipe[1], &fd, sizeof(int));
+        worker_task_t task = {-1, NULL, 0, 0, NULL, NULL};
+        ssize_t size = write(worker->pipe[1], &task, sizeof(worker_task_t));
 
         if (-1 != size)
             pthread_join(worker->thread, NULL);
@@ -0,0 +1,64 @@
+#! /bin/bash
+
+# Compares event engines of app.out on the /dummy handler
+# $1 - utility (see ./run_single.sh l)
+# $2 - port
+# $3 - requests
+# $4 - concurrency
+# $5 - server root (optional, defaults to current directory)
+# $6 - engines (optional, defaults to "reactor uring")
+
+port=$2
+url="http://127.0.0.1:${port}/dummy"
+requests=$3
+concurrency=$4
+root=${5:-.}
+engines=${6:-"reactor uring"}
+app=$(realpath ../app.out)
+
+source ./extract/"$1.extract.sh"
+extractor=$(extract)
+
+file=./engine/${requests}_${concurrency}
+
+mkdir -p ./engine
+echo "engine,time,syscalls,syscalls_per_request" > "$file"
+
+for engine in ${engines};
+do
+    echo "Start ${engine}"
+    sudo LD_PRELOAD=/usr/lib/libgcc_s.so.1 "${app}" -p "${port}" -l error \
+        -e "${engine}" "${root}" &
+    sleep 1
+    pid=$(pgrep -n -f "${app} -p ${port}")
+
+    # System calls of the server are counted, when strace is available
+    trace=""
+
+    if command -v strace > /dev/null; then
+        trace=$(mktemp)
+        sudo strace -c -f -q -p "${pid}" -o "${trace}" &
+        tracer=$!
+        sleep 1
+    fi
+
+    t=$(eval "./run_single.sh $1 ${requests} ${concurrency} \"${url}\" | $extractor")
+    calls=""
+    per=""
+
+    if [ -n "${trace}" ]; then
+        sudo kill -INT "${tracer}"
+        wait "${tracer}" 2> /dev/null
+        calls=$(grep " total" "${trace}" | awk '{print $4}')
+        per=$(echo "scale=2; ${calls} / ${requests}" | bc)
+        rm -f "${trace}"
+    fi
+
+    sudo kill -INT "${pid}"
+    wait
+
+    echo "${engine},${t},${calls},${per}" >> "$file"
+    echo "Finish ${engine}: ${t}"
+done
+
+cat "$file"
@@ -2,7 +2,7 @@ import { check } from 'k6';
 import http from 'k6/http';
 
 export const options = {
-    noConnectionReuse: true
+    noConnectionReuse: !__ENV.KEEPALIVE
 };
 
 export default function () {
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+
+#include "multiplexer.h"
+
+// Wakeup latency and CPU cost of a single wait for every multiplexer backend.
+// Registered connections are idle eventfds, on every round another thread
+// writes to one of them, while the main thread waits for it to be readable.
+
+#define ROUNDS 2000
+
+typedef struct
+{
+    int *fds;
+    size_t size;
+    sem_t go;
+    uint64_t stamp;
+    int stop;
+} bench_t;
+
+static const size_t sizes[] = {100, 1000, 10000};
+
+static const struct
+{
+    const char *name;
+    multiplexer_type_t type;
+} types[] =
+{
+    {"epoll", MULTIPLEXER_EPOLL},
+    {"poll", MULTIPLEXER_POLL},
+    {"select", MULTIPLEXER_SELECT}
+};
+
+static uint64_t now(const clockid_t clock)
+{
+    struct timespec time;
+
+    clock_gettime(clock, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t l = *(const uint64_t *)a, r = *(const uint64_t *)b;
+
+    return (l > r) - (l < r);
+}
+
+static void *writer(void *arg)
+{
+    bench_t *bench = arg;
+    uint64_t value = 1;
+
+    for (size_t i = 0; ; i++)
+    {
+        sem_wait(&bench->go);
+
+        if (bench->stop)
+            break;
+
+        int fd = bench->fds[(i * 7919) % bench->size];
+
+        uint64_t stamp = now(CLOCK_MONOTONIC);
+
+        __atomic_store_n(&bench->stamp, stamp, __ATOMIC_RELEASE);
+
+        if (sizeof(value) != write(fd, &value, sizeof(value)))
+            perror("write");
+    }
+
+    return NULL;
+}
+
+static int run(const char *name, const multiplexer_type_t type,
+               const size_t size)
+{
+    multiplexer_t *multiplexer = multiplexer_init(type);
+    bench_t bench = {calloc(size, sizeof(int)), 0, {{0}}, 0, 0};
+    uint64_t *latency = malloc(ROUNDS * sizeof(uint64_t));
+    int rc = EXIT_SUCCESS;
+
+    if (NULL == multiplexer || NULL == bench.fds || NULL == latency)
+        rc = EXIT_FAILURE;
+
+    while (EXIT_SUCCESS == rc && size > bench.size)
+    {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (-1 == fd)
+            rc = EXIT_FAILURE;
+        else if (EXIT_SUCCESS != multiplexer_add(multiplexer, fd, READ, 0))
+        {
+            close(fd);
+            rc = EXIT_FAILURE;
+        }
+        else
+            bench.fds[bench.size++] = fd;
+    }
+
+    if (EXIT_SUCCESS != rc)
+        printf("%-8s %6zu  unsupported (%zu registered)\n", name, size,
+               bench.size);
+
+    pthread_t thread;
+    int started = 0;
+    uint64_t spent = 0;
+
+    if (EXIT_SUCCESS == rc)
+    {
+        sem_init(&bench.go, 0, 0);
+
+        if (pthread_create(&thread, NULL, writer, &bench))
+            rc = EXIT_FAILURE;
+        else
+            started = 1;
+    }
+
+    for (size_t i = 0; EXIT_SUCCESS == rc && ROUNDS > i; i++)
+    {
+        multiplexer_event_t events[16];
+        size_t count = 0;
+        uint64_t value;
+
+        sem_post(&bench.go);
+
+        uint64_t start = now(CLOCK_THREAD_CPUTIME_ID);
+
+        while (EXIT_SUCCESS == rc && 0 == count)
+            rc = multiplexer_wait(multiplexer, events, 16, &count, 1000);
+
+        uint64_t end = now(CLOCK_MONOTONIC);
+
+        spent += now(CLOCK_THREAD_CPUTIME_ID) - start;
+        latency[i] = end - __atomic_load_n(&bench.stamp, __ATOMIC_ACQUIRE);
+
+        for (size_t j = 0; count > j; j++)
+            if (sizeof(value) != read(events[j].fd, &value, sizeof(value)))
+                rc = EXIT_FAILURE;
+    }
+
+    if (started)
+    {
+        bench.stop = 1;
+        sem_post(&bench.go);
+        pthread_join(thread, NULL);
+        sem_destroy(&bench.go);
+    }
+
+    if (started && EXIT_SUCCESS == rc)
+    {
+        qsort(latency, ROUNDS, sizeof(uint64_t), compare);
+
+        uint64_t total = 0;
+
+        for (size_t i = 0; ROUNDS > i; i++)
+            total += latency[i];
+
+        printf("%-8s %6zu  %10.2f %10.2f %10.2f %12.2f\n", name, size,
+               total / 1000.0 / ROUNDS, latency[ROUNDS / 2] / 1000.0,
+               latency[ROUNDS * 99 / 100] / 1000.0,
+               spent / 1000.0 / ROUNDS);
+    }
+
+    for (size_t i = 0; bench.size > i; i++)
+        close(bench.fds[i]);
+
+    multiplexer_free(&multiplexer);
+    free(bench.fds);
+    free(latency);
+
+    return rc;
+}
+
+int main(void)
+{
+    struct rlimit limit;
+
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    printf("%-8s %6s  %10s %10s %10s %12s\n", "backend", "conns", "avg, us",
+           "p50, us", "p99, us", "cpu/wait, us");
+
+    for (size_t i = 0; sizeof(types) / sizeof(types[0]) > i; i++)
+        for (size_t j = 0; sizeof(sizes) / sizeof(sizes[0]) > j; j++)
+            run(types[i].name, types[i].type, sizes[j]);
+
+    return EXIT_SUCCESS;
+}